@@ -0,0 +1,57 @@
+# This module can find the Zstandard (zstd) library
+#
+# The following variables will be defined for your use:
+#   - ZSTD_FOUND          : was zstd found?
+#   - ZSTD_INCLUDE_DIRS   : zstd include directory
+#   - ZSTD_LIBRARIES      : zstd library
+#   - ZSTD_VERSION_STRING : complete version of zstd (x.y.z)
+#
+# For non standard installation, define ZSTD_ROOT_DIR variable (as a cmake
+# variable or an environment variable) to point to the root installation
+# of zstd.
+#
+# ZSTD_INCLUDE_DIR is also set when only the header is found, which is
+# enough to build a reader which loads the library at runtime.
+
+set(_ZSTD_ROOT "")
+if(DEFINED ENV{ZSTD_ROOT_DIR})
+    set(_ZSTD_ROOT "$ENV{ZSTD_ROOT_DIR}")
+endif(DEFINED ENV{ZSTD_ROOT_DIR})
+if(DEFINED ZSTD_ROOT_DIR)
+    set(_ZSTD_ROOT "${ZSTD_ROOT_DIR}")
+endif(DEFINED ZSTD_ROOT_DIR)
+
+if(_ZSTD_ROOT)
+    set(_ZSTD_HINTS HINTS ${_ZSTD_ROOT} NO_DEFAULT_PATH)
+else(_ZSTD_ROOT)
+    find_package(PkgConfig QUIET)
+    if(PKG_CONFIG_FOUND)
+        pkg_check_modules(_PC_ZSTD QUIET libzstd)
+    endif(PKG_CONFIG_FOUND)
+    set(_ZSTD_HINTS HINTS ${_PC_ZSTD_INCLUDE_DIRS} ${_PC_ZSTD_LIBRARY_DIRS})
+endif(_ZSTD_ROOT)
+
+find_path(ZSTD_INCLUDE_DIR NAMES zstd.h ${_ZSTD_HINTS} PATH_SUFFIXES include)
+find_library(ZSTD_LIBRARY NAMES zstd zstd_static ${_ZSTD_HINTS} PATH_SUFFIXES lib lib64)
+
+if(ZSTD_INCLUDE_DIR AND EXISTS "${ZSTD_INCLUDE_DIR}/zstd.h")
+    file(STRINGS "${ZSTD_INCLUDE_DIR}/zstd.h" _ZSTD_VERSION_LINES REGEX "^#define[ \t]+ZSTD_VERSION_(MAJOR|MINOR|RELEASE)[ \t]+[0-9]+")
+    foreach(_ZSTD_PART MAJOR MINOR RELEASE)
+        string(REGEX REPLACE ".*#define[ \t]+ZSTD_VERSION_${_ZSTD_PART}[ \t]+([0-9]+).*" "\\1" _ZSTD_VERSION_${_ZSTD_PART} "${_ZSTD_VERSION_LINES}")
+    endforeach(_ZSTD_PART)
+    set(ZSTD_VERSION_STRING "${_ZSTD_VERSION_MAJOR}.${_ZSTD_VERSION_MINOR}.${_ZSTD_VERSION_RELEASE}")
+endif(ZSTD_INCLUDE_DIR AND EXISTS "${ZSTD_INCLUDE_DIR}/zstd.h")
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(
+    ZSTD
+    REQUIRED_VARS ZSTD_LIBRARY ZSTD_INCLUDE_DIR
+    VERSION_VAR ZSTD_VERSION_STRING
+)
+
+if(ZSTD_FOUND)
+    set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+    set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+endif(ZSTD_FOUND)
+
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
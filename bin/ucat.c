@@ -31,6 +31,7 @@ static UBool nFlag = FALSE;
 static UBool sFlag = FALSE;
 static UBool vFlag = FALSE;
 static UBool file_print = FALSE; // -H/h
+static UBool verbatim = FALSE; /* lines are output unaltered, in UTF-8 */
 static int binbehave = BIN_FILE_SKIP;
 
 /* ========== getopt stuff ========== */
@@ -76,6 +77,7 @@ static void usage(void)
 
 static int procfile(reader_t *reader, const char *filename, void *UNUSED(userdata))
 {
+    UString line;
     error_t *error;
     UBool numbered, count, prev_was_blank;
 
@@ -89,16 +91,25 @@ static int procfile(reader_t *reader, const char *filename, void *UNUSED(userdat
             lineno = 0;
             u_fprintf(ustdout, "%s:\n", filename);
         }
+        if (verbatim) {
+            /* lines which would be output unaltered are copied without being decoded then encoded back */
+            u_fflush(ustdout);
+            if (!reader_copy_verbatim(reader, &error, STDOUT_FILENO)) {
+                print_error(error);
+                reader_close(reader);
+                return 1;
+            }
+        }
         /* !fd->binary || (fd->binary && BIN_FILE_BIN != binbehave) */
         while (!reader_eof(reader)) {
-            if (!reader_readline(reader, &error, ustr)) {
+            if (!reader_readline_view(reader, &error, &line)) {
                 print_error(error);
+                break;
             }
-            ustring_chomp(ustr);
             if (bFlag || sFlag) {
                 UBool blank;
 
-                blank = ustring_empty(ustr);
+                blank = ustring_empty(&line);
                 if (bFlag) {
                     numbered = count = !blank;
                 }
@@ -112,16 +123,22 @@ static int procfile(reader_t *reader, const char *filename, void *UNUSED(userdat
             if (count) {
                 lineno++;
             }
-            if (BIN_FILE_TEXT == binbehave || vFlag) {
-                ustring_dump(ustr);
-            }
-            if (EFlag) {
-                ustring_append_char(ustr, 0x0024);
+            if (BIN_FILE_TEXT == binbehave || vFlag || EFlag) {
+                /* the line is altered: work on a copy */
+                ustring_truncate(ustr);
+                ustring_append_string_len(ustr, line.ptr, line.len);
+                if (BIN_FILE_TEXT == binbehave || vFlag) {
+                    ustring_dump(ustr);
+                }
+                if (EFlag) {
+                    ustring_append_char(ustr, 0x0024);
+                }
+                line = *ustr;
             }
             if (numbered) {
                 u_fprintf(ustdout, "%6d  ", lineno);
             }
-            u_fputs(ustr->ptr, ustdout);
+            u_fputs(line.ptr, ustdout);
         }
         reader_close(reader);
     } else {
@@ -242,12 +259,14 @@ int main(int argc, char **argv)
     env_apply();
 
     reader_set_binary_behavior(reader, binbehave);
+    verbatim = !bFlag && !nFlag && !sFlag && !vFlag && !EFlag && BIN_FILE_TEXT != binbehave
+        && UNORM_NONE == env_get_normalization() && 0 == ucnv_compareNames("UTF-8", u_fgetcodepage(ustdout));
 
     ustr = ustring_new();
     env_register_resource(ustr, (func_dtor_t) ustring_destroy);
 
     if (0 == argc) {
-        ret |= procfile(reader, "-", NULL);
+        ret |= procarchive(reader, "-", NULL, procfile);
 #ifdef WITH_FTS
     } else if (DIR_RECURSE == get_dirbehave()) {
         ret |= procdir(reader, argv, NULL, procfile);
@@ -259,7 +278,7 @@ int main(int argc, char **argv)
                 continue;
             }
 #endif /* WITH_FTS */
-            ret |= procfile(reader, *argv, NULL);
+            ret |= procarchive(reader, *argv, NULL, procfile);
         }
     }
 
@@ -28,7 +28,6 @@ static UBool sFlag = FALSE;
 
 static const UChar DEFAULT_DELIM[] = { U_HT, 0 };
 
-static UString *ustr = NULL;
 static UBreakIterator *ubrk = NULL;
 static UString *input_delim = NULL;
 static UString *output_delim = NULL;
@@ -146,25 +145,26 @@ static int32_t split_on_indices(error_t **error, UBreakIterator *ubrk, UString *
 
 static int procfile(reader_t *reader, const char *filename)
 {
+    UString line;
     error_t *error;
     int32_t j, count;
 
     error = NULL;
     if (reader_open(reader, &error, filename)) {
         while (!reader_eof(reader)) {
-            if (!reader_readline(reader, &error, ustr)) {
+            if (!reader_readline_view(reader, &error, &line)) {
                 print_error(error);
+                break;
             }
-            ustring_chomp(ustr);
             darray_clear(pieces);
             if (fFlag) {
-                if (!pdata.engine->split(&error, pdata.pattern, ustr, pieces, intervals)) {
+                if (!pdata.engine->split(&error, pdata.pattern, &line, pieces, intervals)) {
                     print_error(error);
                     return 1;
                 }
                 count = darray_length(pieces);
             } else if (cFlag) {
-                count = split_on_indices(&error, ubrk, ustr, pieces, intervals);
+                count = split_on_indices(&error, ubrk, &line, pieces, intervals);
             } else {
                 assert(FALSE);
             }
@@ -181,7 +181,7 @@ static int procfile(reader_t *reader, const char *filename)
                 }
                 u_file_write(EOL, EOL_LEN, ustdout);
             } else if (!sFlag && fFlag) {
-                u_file_write(ustr->ptr, ustr->len, ustdout);
+                u_file_write(line.ptr, line.len, ustdout);
                 u_file_write(EOL, EOL_LEN, ustdout);
             }
         }
@@ -316,8 +316,6 @@ int main(int argc, char **argv)
         fprintf(stderr, "Using regular expression implies an output-delimiter\n");
         return UCUT_EXIT_USAGE;
     }*/
-    ustr = ustring_new();
-    env_register_resource(ustr, (func_dtor_t) ustring_destroy);
     pieces = darray_sized_new(interval_list_length(intervals), sizeof(match_t));
     env_register_resource(pieces, (func_dtor_t) darray_destroy);
 
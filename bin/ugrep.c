@@ -38,6 +38,11 @@ enum {
     PATTERN_AUTO
 };
 
+typedef struct {
+    char *ptr; /* UTF-8 */
+    int32_t len;
+} raw_pattern_t;
+
 typedef struct {
     UString *ustr;
     UBool match;
@@ -99,6 +104,8 @@ engine_t *engines[] = {
 
 static fixed_circular_list_t *lines = NULL;
 static slist_t *patterns = NULL;
+static slist_t *raw_patterns = NULL; /* patterns, as UTF-8, if all of them can be searched on raw lines */
+static UBool raw_capable = TRUE;
 static int binbehave = BIN_FILE_SKIP;
 #ifndef NO_COLOR
 # ifndef _MSC_VER
@@ -174,6 +181,7 @@ enum {
 // #ifndef NO_COLOR
     COLOR_OPT,
 // #endif /* !NO_COLOR */
+    LINE_WINDOW_OPT,
     //READER_OPT
 };
 
@@ -190,6 +198,7 @@ static struct option long_options[] =
     {"colour",              required_argument, NULL, COLOR_OPT},
 // #endif /* !NO_COLOR */
     {"binary-files",        required_argument, NULL, BINARY_OPT},
+    {"line-window",         required_argument, NULL, LINE_WINDOW_OPT},
     {"after-context",       required_argument, NULL, 'A'},
     {"before-context",      required_argument, NULL, 'B'},
     {"context",             required_argument, NULL, 'C'},
@@ -221,7 +230,7 @@ static void usage(void)
     fprintf(
         stderr,
         "usage: %s [-0123456789EFHLRVchilnoqrsvwx] [-A num] [-B num]\n"
-        "\t[-e pattern] [-f file] [--binary-files=value]\n"
+        "\t[-e pattern] [-f file] [--binary-files=value] [--line-window=size]\n"
         "\t[pattern] [file ...]\n",
         __progname
     );
@@ -236,6 +245,54 @@ static void usage(void)
         flags &= ~OPT_WORD_BOUND; \
     }
 
+/**
+ * The fixed engine, when it only has to compare code units, can be emulated
+ * on UTF-8 bytes (U+FFFD excluded: it may stand for an invalid sequence)
+ **/
+static void add_raw_pattern(const UString *ustr, int pattern_type, uint32_t flags)
+{
+    int32_t length;
+    UErrorCode status;
+    raw_pattern_t *rp;
+
+    if (!raw_capable) {
+        return;
+    }
+    if (
+        PATTERN_LITERAL != pattern_type
+        || IS_CASE_INSENSITIVE(flags)
+        || IS_WORD_BOUNDED(flags)
+        || (!IS_WHOLE_LINE(flags) && WITH_GRAPHEME())
+        || NULL != u_memchr(ustr->ptr, 0xFFFD, ustr->len)
+    ) {
+        raw_capable = FALSE;
+        return;
+    }
+    status = U_ZERO_ERROR;
+    u_strToUTF8(NULL, 0, &length, ustr->ptr, ustr->len, &status);
+    if (U_BUFFER_OVERFLOW_ERROR != status && U_FAILURE(status)) {
+        raw_capable = FALSE;
+        return;
+    }
+    rp = mem_new(*rp);
+    rp->len = length;
+    rp->ptr = mem_new_n(*rp->ptr, length + 1);
+    status = U_ZERO_ERROR;
+    u_strToUTF8(rp->ptr, length + 1, NULL, ustr->ptr, ustr->len, &status);
+    if (U_FAILURE(status)) {
+        raw_capable = FALSE;
+    }
+    slist_append(raw_patterns, rp);
+}
+
+static void raw_pattern_destroy(void *data)
+{
+    FETCH_DATA(data, rp, raw_pattern_t);
+
+    free(rp->ptr);
+    free(rp);
+}
+
 UBool add_pattern(error_t **error, slist_t *l, UString *ustr, int pattern_type, uint32_t flags)
 {
     void *data;
@@ -250,6 +307,7 @@ UBool add_pattern(error_t **error, slist_t *l, UString *ustr, int pattern_type,
     if (ustring_empty(ustr)) {
         pattern_type = PATTERN_LITERAL;
     }
+    add_raw_pattern(ustr, pattern_type, flags);
     if (NULL == (data = engines[!!pattern_type]->compile(error, ustr, flags))) {
         return FALSE;
     }
@@ -277,6 +335,7 @@ UBool add_patternC(error_t **error, slist_t *l, const char *pattern, int pattern
     if (ustring_empty(ustr)) {
         pattern_type = PATTERN_LITERAL;
     }
+    add_raw_pattern(ustr, pattern_type, flags);
     if (NULL == (data = engines[!!pattern_type]->compile(error, ustr, flags))) {
         return FALSE;
     }
@@ -291,18 +350,19 @@ UBool add_patternC(error_t **error, slist_t *l, const char *pattern, int pattern
 
 UBool source_patterns(error_t **error, const char *filename, slist_t *l, int pattern_type, uint32_t flags)
 {
-    reader_t reader;
+    reader_t *reader;
     UBool retval;
     UString *ustr;
 
     retval = TRUE;
-    reader_set_imp_by_name(&reader, "stdio");
-    if (!reader_open(&reader, error, filename)) {
+    reader = reader_new("stdio");
+    if (!reader_open(reader, error, filename)) {
+        env_unregister_resource(reader);
         return FALSE;
     }
     ustr = ustring_new();
-    while (retval && !reader_eof(&reader)) {
-        if (!reader_readline(&reader, error, ustr)) {
+    while (retval && !reader_eof(reader)) {
+        if (!reader_readline(reader, error, ustr)) {
             retval = FALSE;
         } else {
             ustring_chomp(ustr);
@@ -311,7 +371,8 @@ UBool source_patterns(error_t **error, const char *filename, slist_t *l, int pat
             }
         }
     }
-    reader_close(&reader);
+    reader_close(reader);
+    env_unregister_resource(reader);
     ustring_destroy(ustr);
 
     return retval;
@@ -735,6 +796,119 @@ void fixed_circular_list_print(fixed_circular_list_t *l) /* NONNULL() */
 }
 #endif /* DEBUG */
 
+/**
+ * Length of line without its end of line (as ustring_chomp)
+ **/
+static int32_t raw_chomp(const char *line, int32_t length)
+{
+    if (length > 0) {
+        switch ((uint8_t) line[length - 1]) {
+            case 0x0A:
+                if (length > 1 && 0x0D == line[length - 2]) {
+                    return length - 2;
+                }
+                /* FALLTHROUGH */
+            case 0x0B:
+            case 0x0C:
+            case 0x0D:
+                return length - 1;
+            case 0x85: /* C2 85 */
+                if (length > 1 && 0xC2 == (uint8_t) line[length - 2]) {
+                    return length - 2;
+                }
+                break;
+            case 0xA8: /* E2 80 A8 */
+            case 0xA9: /* E2 80 A9 */
+                if (length > 2 && 0xE2 == (uint8_t) line[length - 3] && 0x80 == (uint8_t) line[length - 2]) {
+                    return length - 3;
+                }
+                break;
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Print the part [from;to[ of a window of an over-long line, or, with -o,
+ * the matches it owns (see reader_set_line_window). As a match is followed
+ * by an EOL only when the next one doesn't extend it, joint is where the
+ * last printed match ended (-1 if none) and the new value is returned.
+ **/
+static int32_t print_window(const UString *ustr, int32_t from, int32_t to, interval_list_t *intervals, int32_t joint)
+{
+    int32_t last;
+    dlist_element_t *el;
+
+    last = from;
+    for (el = intervals->head; NULL != el; el = el->next) {
+        FETCH_DATA(el->data, i, interval_t);
+
+        if (i->lower_limit >= to) {
+            break;
+        }
+        if (oFlag) {
+            if (-1 != joint && joint != i->lower_limit) {
+                u_file_write(EOL, EOL_LEN, ustdout);
+            }
+            console_apply_color(SINGLE_MATCH);
+            u_file_write(ustr->ptr + i->lower_limit, i->upper_limit - i->lower_limit, ustdout);
+            console_reset(SINGLE_MATCH);
+            joint = i->upper_limit;
+        } else {
+            if (last < i->lower_limit) {
+                u_file_write(ustr->ptr + last, i->lower_limit - last, ustdout);
+                last = i->lower_limit;
+            }
+            if (last < i->upper_limit) {
+                console_apply_color(SINGLE_MATCH);
+                u_file_write(ustr->ptr + last, MIN(i->upper_limit, to) - last, ustdout);
+                console_reset(SINGLE_MATCH);
+                last = MIN(i->upper_limit, to);
+            }
+        }
+    }
+    if (!oFlag && last < to) {
+        u_file_write(ustr->ptr + last, to - last, ustdout);
+    }
+
+    return joint;
+}
+
+/**
+ * Byte level counterpart of the fixed engine (match and whole_line_match)
+ **/
+static UBool raw_match(const char *line, int32_t length)
+{
+    slist_element_t *p;
+
+    for (p = raw_patterns->head; NULL != p; p = p->next) {
+        FETCH_DATA(p->data, rp, raw_pattern_t);
+
+        if (0 == rp->len) {
+            if (!xFlag || 0 == length) {
+                return TRUE;
+            }
+        } else if (xFlag) {
+            /* same as u_strcmp: stop on first NUL */
+            if (strnlen(line, length) == strlen(rp->ptr) && 0 == memcmp(line, rp->ptr, strlen(rp->ptr))) {
+                return TRUE;
+            }
+        } else if (length >= rp->len) {
+            const char *m, *end;
+
+            end = line + length - rp->len;
+            for (m = line; m <= end && NULL != (m = memchr(m, *rp->ptr, end - m + 1)); m++) {
+                if (0 == memcmp(m, rp->ptr, rp->len)) {
+                    return TRUE;
+                }
+            }
+        }
+    }
+
+    return FALSE;
+}
+
 static int procfile(reader_t *reader, const char *filename, void *userdata)
 {
     uint32_t *matches;
@@ -749,8 +923,14 @@ static int procfile(reader_t *reader, const char *filename, void *userdata)
     uint32_t last_line_print;
     uint32_t arg_matches; // matches (for the current file) against command arguments (-v)
     int _after_context;
+    UBool window_match; // a window of the current over-long line matches
+    UBool window_print; // the current over-long line is being printed
+    int32_t window_from; // where the search resumes in the next window
+    int32_t window_joint; // where the last match printed with -o ended (see print_window)
 
     error = NULL;
+    window_from = window_joint = 0;
+    window_match = window_print = FALSE;
     arg_matches = 0;
     _after_context = 0;
     last_line_print = 0;
@@ -762,24 +942,76 @@ static int procfile(reader_t *reader, const char *filename, void *userdata)
     fixed_circular_list_clean(lines);
     if (reader_open(reader, &error, filename)) {
         UBool _line_print; /* line_print local override */
+        UBool raw; /* lines are searched on their bytes and only decoded to be printed */
 
         _line_print = line_print && (!reader->binary || (reader->binary && BIN_FILE_BIN != binbehave));
+        raw = raw_capable && UNORM_NONE == env_get_normalization() && 0 == before_context && 0 == after_context && !(_line_print && BIN_FILE_TEXT == binbehave);
+        if (raw && !reader_start_raw(reader, &error)) {
+            if (NULL != error) {
+                reader_close(reader);
+                print_error(error);
+                return 1;
+            }
+            raw = FALSE;
+        }
         while (!reader_eof(reader)) {
             int pattern_matches; // matches (for the current line) against pattern(s), doesn't take care of arguments (-v)
+            UBool windowed; // the view is a window of an over-long line (see reader_set_line_window)
+            int32_t from, to; // matches have to begin in [from;to[
+            UString view;
             slist_element_t *p;
             engine_return_t ret;
             FETCH_DATA(fixed_circular_list_fetch(lines), line, line_t);
 
             ustr = line->ustr;
             ret = ENGINE_FAILURE;
-            if (!reader_readline(reader, &error, ustr)/* && NULL != error*/) {
-                print_error(error);
+            windowed = FALSE;
+            if (raw) {
+                int32_t length;
+                const char *bytes;
+
+                if (!reader_readline_raw(reader, &error, &bytes, &length)) {
+                    print_error(error);
+                    break;
+                }
+                length = raw_chomp(bytes, length);
+                pattern_matches = raw_match(bytes, length);
+                if (!_line_print || pattern_matches == vFlag) {
+                    /* nothing to print: same as below without decoding the line */
+                    if (pattern_matches && (lFlag || (reader->binary && BIN_FILE_BIN == binbehave))) {
+                        debug("file skipping (%s)", reader->sourcename);
+                        arg_matches = 1;
+                        goto endfile;
+                    }
+                    arg_matches += pattern_matches != vFlag;
+                    if (arg_matches >= max_count) {
+                        goto endfile;
+                    }
+                    continue;
+                }
+                if (!reader_decode_raw(reader, &error, bytes, length, ustr)) {
+                    reader_close(reader);
+                    print_error(error);
+                    return 1;
+                }
+            } else {
+                if (!reader_readline_view(reader, &error, &view)) {
+                    print_error(error);
+                    break;
+                }
+                if (_line_print) {
+                    /* the line is kept (context) and may be altered (escaping, colors): copy it */
+                    ustring_truncate(ustr);
+                    ustring_append_string_len(ustr, view.ptr, view.len);
+                    if (BIN_FILE_TEXT == binbehave) {
+                        ustring_dump(ustr);
+                    }
+                } else {
+                    ustr = &view;
+                }
+                windowed = reader->window.continued || reader->window.partial;
             }
             pattern_matches = 0;
-            ustring_chomp(ustr);
-            if (BIN_FILE_TEXT == binbehave) {
-                ustring_dump(ustr);
-            }
 #ifndef NO_COLOR
 # ifdef _MSC_VER
             intervals = line->intervals;
@@ -787,15 +1019,35 @@ static int procfile(reader_t *reader, const char *filename, void *userdata)
             interval_list_clean(intervals);
 # endif /* _MSC_VER */
 #endif /* !NO_COLOR */
+            from = 0;
+            to = ustr->len + 1;
+            if (windowed) {
+                /**
+                 * A window only owns the matches which begin after its first margin
+                 * (the previous window owns them) and before its last one (the next
+                 * window sees them with what follows).
+                 **/
+                if (reader->window.continued) {
+                    from = window_from;
+                    if (!oFlag && window_from > reader->window.margin) {
+                        /* the end of the last match of the previous window, only to be highlighted */
+                        interval_list_add(intervals, ustr->len, reader->window.margin, window_from);
+                    }
+                }
+                if (reader->window.partial) {
+                    to = ustr->len - reader->window.margin;
+                }
+            }
             for (p = patterns->head; NULL != p; p = p->next) {
                 FETCH_DATA(p->data, pdata, pattern_data_t);
 
                 if (xFlag) {
-                    ret = pdata->engine->whole_line_match(&error, pdata->pattern, ustr);
+                    /* a window never is a whole line */
+                    ret = windowed ? ENGINE_NO_MATCH : pdata->engine->whole_line_match(&error, pdata->pattern, ustr);
                 } else {
 #ifndef NO_COLOR
-                    if (oFlag || (_colorize && _line_print)) {
-                        ret = pdata->engine->match_all(&error, pdata->pattern, ustr, intervals);
+                    if (windowed || oFlag || (_colorize && _line_print)) {
+                        ret = pdata->engine->match_all(&error, pdata->pattern, ustr, from, to, intervals);
                     } else {
 #endif /* !NO_COLOR */
                         ret = pdata->engine->match(&error, pdata->pattern, ustr);
@@ -820,6 +1072,58 @@ static int procfile(reader_t *reader, const char *filename, void *userdata)
                     goto endfile; // no need to continue (file level)
                 }
             }
+            if (windowed) {
+                int32_t shift; // from this window to the next one
+
+                shift = (int32_t) view.len - 2 * reader->window.margin;
+                window_match |= pattern_matches > 0;
+                if (reader->window.partial) {
+                    /* intervals are sorted: the next window resumes after the last match, from its own part */
+                    window_from = reader->window.margin;
+                    if (NULL != intervals->tail) {
+                        FETCH_DATA(intervals->tail->data, i, interval_t);
+
+                        if (i->upper_limit - shift > window_from) {
+                            window_from = i->upper_limit - shift;
+                        }
+                    }
+                }
+                /* the line can't be held as a whole: its windows are printed, as they come, from the first one which matches */
+                if (_line_print && !vFlag && (window_print || pattern_matches)) {
+                    if (!window_print) {
+                        if (file_print) {
+                            print_file(reader->sourcename, FALSE, TRUE, TRUE, FALSE);
+                        }
+                        if (nFlag) {
+                            print_line(reader->lineno, TRUE, TRUE, FALSE);
+                        }
+                        window_print = TRUE;
+                        window_joint = -1;
+                    }
+                    window_joint = print_window(ustr, reader->window.continued ? reader->window.margin : 0, reader->window.partial ? to : (int32_t) ustr->len, intervals, window_joint);
+                }
+                /* over-long lines are not kept for context */
+                fixed_circular_list_clean(lines);
+                if (reader->window.partial) {
+                    if (-1 != window_joint) {
+                        /* 0 can't be joined: a window begins with a margin */
+                        window_joint = MAX(window_joint - shift, 0);
+                    }
+                    continue;
+                }
+                if (window_print) {
+                    u_file_write(EOL, EOL_LEN, ustdout);
+                    last_line_print = reader->lineno;
+                    _after_context = after_context;
+                }
+                line->match = window_match != vFlag;
+                arg_matches += line->match;
+                window_match = window_print = FALSE;
+                if (arg_matches >= max_count) {
+                    goto endfile;
+                }
+                continue;
+            }
             if (!vFlag) {
                 line->match = !!pattern_matches;
             } else {
@@ -1052,6 +1356,8 @@ int main(int argc, char **argv)
     reader = reader_new(DEFAULT_READER_NAME);
     patterns = slist_new(pattern_destroy);
     env_register_resource(patterns, (func_dtor_t) slist_destroy);
+    raw_patterns = slist_new(raw_pattern_destroy);
+    env_register_resource(raw_patterns, (func_dtor_t) slist_destroy);
 
     switch (__progname[1]) {
         case 'e':
@@ -1200,6 +1506,29 @@ int main(int argc, char **argv)
                     return UGREP_EXIT_USAGE;
                 }
                 break;
+            /**
+             * Over-long lines are searched by windows, which comes with limits:
+             * - a match must not be longer than a quarter of the window
+             * - a line is printed from the first window which matches
+             * - it is never kept as context and never matches -x
+             * - it can't be printed when selected by -v, as it is only known
+             *   to be after its windows are gone (see below)
+             **/
+            case LINE_WINDOW_OPT:
+            {
+                char *endptr;
+                int32_t min, val;
+
+                min = MIN_LINE_WINDOW;
+                if (PARSE_NUM_NO_ERR != parse_int32_t(optarg, &endptr, 10, &min, NULL, &val)) {
+                    fprintf(stderr, "Invalid line window '%s' (expect at least %d characters)\n", optarg, MIN_LINE_WINDOW);
+                    return UGREP_EXIT_USAGE;
+                }
+                reader_set_line_window(reader, val);
+                /* raw lines are not bounded */
+                raw_capable = FALSE;
+                break;
+            }
             default:
                 if (!util_opt_parse(c, optarg, reader)) {
                     usage();
@@ -1228,6 +1557,10 @@ int main(int argc, char **argv)
     if (binbehave != BIN_FILE_TEXT && (cFlag || lFlag || LFlag)) {
         binbehave = BIN_FILE_TEXT;
     }
+    if (vFlag && line_print && 0 != reader->window.size) {
+        fprintf(stderr, "--line-window can't print the lines selected by -v (use it with -c, -l, -L or -q)\n");
+        return UGREP_EXIT_USAGE;
+    }
 
     OPTIONS_TO_ENGINE_FLAGS(flags, iFlag, wFlag, xFlag);
     if (slist_empty(patterns)) {
@@ -1271,7 +1604,7 @@ int main(int argc, char **argv)
 #endif /* !NO_COLOR */
 
     if (0 == argc) {
-        ret |= procfile(reader, "-", &matches);
+        ret |= procarchive(reader, "-", &matches, procfile);
 #ifdef WITH_FTS
     } else if (DIR_RECURSE == get_dirbehave()) {
         ret |= procdir(reader, argv, &matches, procfile);
@@ -1283,7 +1616,7 @@ int main(int argc, char **argv)
                 continue;
             }
 #endif /* WITH_FTS */
-            ret |= procfile(reader, *argv, &matches);
+            ret |= procarchive(reader, *argv, &matches, procfile);
         }
     }
 
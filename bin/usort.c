@@ -72,7 +72,6 @@ extern engine_t fixed_engine;
 // extern engine_t re_engine;
 
 static RBTree *tree = NULL;
-static UString *ustr = NULL;
 static DArray *pieces = NULL;
 static DPtrArray *fields = NULL;
 static UString *separator = NULL;
@@ -712,23 +711,23 @@ echo -en "0Xjanvier\n0Xfévrier\n0Xmars\n0Xavril" | ./usort -t 'X' -r --sort=mon
 static int procfile(reader_t *reader, const char *filename)
 {
     RBKey *key;
+    UString line;
     error_t *error;
 
     key = NULL;
     error = NULL;
     if (reader_open(reader, &error, filename)) {
         while (!reader_eof(reader)) {
-            if (!reader_readline(reader, &error, ustr)) {
-                print_error(error);
+            if (!reader_readline_view(reader, &error, &line)) {
+                break; // error is handled right after
             }
-            ustring_chomp(ustr);
             if (bFlag) {
-                ustring_ltrim(ustr);
+                ustring_ltrim(&line);
             }
 #if 1 /* split here */
 {
             darray_clear(pieces);
-            if (pdata.engine->split(&error, pdata.pattern, ustr, pieces, NULL)) {
+            if (pdata.engine->split(&error, pdata.pattern, &line, pieces, NULL)) {
                 size_t i, count;
 
                 count = darray_length(pieces);
@@ -759,7 +758,7 @@ assert(field->start_field <= count);
                             sprintf(dump + j, "0x%02X", key->key[i]);
                         }
                         dump[j] = '\0';
-                        debug("For >%S<, sort on >%.*S< (%d) >%S<: key = >%s<", ustr->ptr, m.len, m.ptr, m.len, m.ptr, dump);
+                        debug("For >%S<, sort on >%.*S< (%d) >%S<: key = >%s<", line.ptr, m.len, m.ptr, m.len, m.ptr, dump);
                         free(dump);
                     }
 #endif /* DEBUG */
@@ -773,7 +772,7 @@ assert(field->start_field <= count);
 #endif
             // TODO: put a Line struct as value
             if (/**/TRUE || /**/uFlag) {
-                rbtree_insert(tree, key, ustr, RBTREE_INSERT_ON_DUP_KEY_PRESERVE, NULL);
+                rbtree_insert(tree, key, &line, RBTREE_INSERT_ON_DUP_KEY_PRESERVE, NULL);
             } else {
                 int v;
                 int *p;
@@ -942,8 +941,6 @@ int main(int argc, char **argv)
 //     tree = rbtree_collated_new(ucol, rFlag, (dup_t) ustring_dup, uFlag ? NODUP : SIZE_TO_DUP_T(sizeof(int)), (func_dtor_t) ustring_destroy, uFlag ? NULL : free);
     tree = rbtree_new(cmp_func, NODUP /* key duper */, (dup_t) ustring_dup /*value duper */, (func_dtor_t) rbkey_destroy/*free*/ /* key dtor */, (func_dtor_t) ustring_destroy /* value dtor */);
     env_register_resource(tree, (func_dtor_t) rbtree_destroy);
-    ustr = ustring_new();
-    env_register_resource(ustr, (func_dtor_t) ustring_destroy);
 
     if (0 == argc) {
         ret |= procfile(reader, "-");
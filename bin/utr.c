@@ -857,7 +857,14 @@ int main(int argc, char **argv)
 #endif /* DEBUG */
     while (!reader_eof(reader)) {
         if (!reader_readline(reader, &error, in)) {
-            print_error(error);
+            /* FALSE is also returned for a last line without end of line */
+            if (NULL != error) {
+                print_error(error);
+                break;
+            }
+            if (ustring_empty(in)) {
+                break;
+            }
         }
         ustring_chomp(in);
 
@@ -16,6 +16,7 @@
 # include <unicode/ustdio.h>
 # include <unicode/ustring.h>
 # include <unicode/unorm.h>
+# include <unicode/unorm2.h>
 
 
 # ifdef __GNUC__
@@ -54,6 +55,13 @@
 #  define PRINTF(string_index, first_to_check)
 # endif /* FORMAT,PRINTF */
 
+/* for functions used as dup_t: their address must be even to not be confused with a size (see SIZE_TO_DUP_T) */
+# if GCC_VERSION || __has_attribute(aligned)
+#  define DUPER __attribute__((aligned(2)))
+# else
+#  define DUPER
+# endif /* DUPER */
+
 # ifdef _MSC_VER
 #  define inline _inline
 #  define __func__ __FUNCTION__
@@ -44,7 +44,7 @@ debug("add_match [%d;%d[ for >%S< (>%.*S< ; %d)", l, u, subject->ptr, m.len, m.p
 typedef struct {
     void *(*compile)(error_t **, UString *, uint32_t); /* /!\ The UString will be owned by the engine: it can be freed at any time depending on the internal behavior of the engine /!\ */
     engine_return_t (*match)(error_t **, void *, const UString *);
-    engine_return_t (*match_all)(error_t **, void *, const UString *, interval_list_t *);
+    engine_return_t (*match_all)(error_t **, void *, const UString *, int32_t, int32_t, interval_list_t *); /* only matches which begin in [from;to[ are searched */
     engine_return_t (*whole_line_match)(error_t **, void *, const UString *);
     UBool (*split)(error_t **, void *, const UString *, DArray *, interval_list_t *);
     void (*destroy)(void *);
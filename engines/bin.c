@@ -157,7 +157,7 @@ static engine_return_t engine_bin_match(error_t **error, void *data, const UStri
     }
 }
 
-static engine_return_t engine_bin_match_all(error_t **error, void *data, const UString *subject, interval_list_t *intervals)
+static engine_return_t engine_bin_match_all(error_t **error, void *data, const UString *subject, int32_t from, int32_t to, interval_list_t *intervals)
 {
     int32_t matches;
     UErrorCode status;
@@ -198,7 +198,7 @@ static engine_return_t engine_bin_match_all(error_t **error, void *data, const U
         UChar *m;
         int32_t pos;
 
-        pos = 0;
+        pos = from;
         if (NULL != p->ubrk) {
             ubrk_setText(p->ubrk, subject->ptr, subject->len, &status);
             if (U_FAILURE(status)) {
@@ -208,6 +208,9 @@ static engine_return_t engine_bin_match_all(error_t **error, void *data, const U
         }
         while (NULL != (m = u_strFindFirst(subject->ptr + pos, subject->len - pos, p->pattern->ptr, p->pattern->len))) {
             pos = m - subject->ptr;
+            if (pos >= to) {
+                break;
+            }
             if (NULL == p->ubrk || (ubrk_isBoundary(p->ubrk, pos) && ubrk_isBoundary(p->ubrk, pos + p->pattern->len))) {
                 matches++;
                 if (interval_list_add(intervals, subject->len, pos, pos + p->pattern->len)) {
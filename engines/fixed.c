@@ -156,7 +156,7 @@ static engine_return_t engine_fixed_match(error_t **error, void *data, const USt
     }
 }
 
-static engine_return_t engine_fixed_match_all(error_t **error, void *data, const UString *subject, interval_list_t *intervals)
+static engine_return_t engine_fixed_match_all(error_t **error, void *data, const UString *subject, int32_t from, int32_t to, interval_list_t *intervals)
 {
     int32_t matches;
     UErrorCode status;
@@ -201,7 +201,7 @@ static engine_return_t engine_fixed_match_all(error_t **error, void *data, const
                 icu_error_set(error, FATAL, status, "usearch_setText");
                 return ENGINE_FAILURE;
             }
-            for (l = usearch_first(p->usearch, &status); U_SUCCESS(status) && USEARCH_DONE != l; l = usearch_next(p->usearch, &status)) {
+            for (l = usearch_following(p->usearch, from, &status); U_SUCCESS(status) && USEARCH_DONE != l && l < to; l = usearch_next(p->usearch, &status)) {
                 matches++;
                 u = l + usearch_getMatchedLength(p->usearch);
                 if (interval_list_add(intervals, subject->len, l, u)) {
@@ -209,7 +209,7 @@ static engine_return_t engine_fixed_match_all(error_t **error, void *data, const
                 }
             }
             if (U_FAILURE(status)) {
-                icu_error_set(error, FATAL, status, "usearch_[first|next]");
+                icu_error_set(error, FATAL, status, "usearch_[following|next]");
                 return ENGINE_FAILURE;
             }
             usearch_unbindText(p->usearch);
@@ -222,7 +222,7 @@ static engine_return_t engine_fixed_match_all(error_t **error, void *data, const
         UChar *m;
         int32_t pos;
 
-        pos = 0;
+        pos = from;
         if (NULL != p->ubrk) {
             ubrk_setText(p->ubrk, subject->ptr, subject->len, &status);
             if (U_FAILURE(status)) {
@@ -232,6 +232,9 @@ static engine_return_t engine_fixed_match_all(error_t **error, void *data, const
         }
         while (NULL != (m = u_strFindFirst(subject->ptr + pos, subject->len - pos, p->pattern->ptr, p->pattern->len))) {
             pos = m - subject->ptr;
+            if (pos >= to) {
+                break;
+            }
             if (NULL == p->ubrk || (ubrk_isBoundary(p->ubrk, pos) && ubrk_isBoundary(p->ubrk, pos + p->pattern->len))) {
                 matches++;
                 if (interval_list_add(intervals, subject->len, pos, pos + p->pattern->len)) {
@@ -116,10 +116,11 @@ static engine_return_t engine_re_match(error_t **error, void *data, const UStrin
     return (ret ? ENGINE_MATCH_FOUND : ENGINE_NO_MATCH);
 }
 
-static engine_return_t engine_re_match_all(error_t **error, void *data, const UString *subject, interval_list_t *intervals)
+static engine_return_t engine_re_match_all(error_t **error, void *data, const UString *subject, int32_t from, int32_t to, interval_list_t *intervals)
 {
     int matches;
     int32_t l, u;
+    UBool found;
     UErrorCode status;
     FETCH_DATA(data, p, re_pattern_t);
 
@@ -137,12 +138,16 @@ static engine_return_t engine_re_match_all(error_t **error, void *data, const US
             return ENGINE_FAILURE;
         }
     }
-    while (uregex_findNext(p->uregex, &status)) {
+    /* uregex_find resets the region to the whole subject: what precedes from remains visible to anchors and look-behinds */
+    for (found = uregex_find(p->uregex, from, &status); found; found = uregex_findNext(p->uregex, &status)) {
         l = uregex_start(p->uregex, 0, &status);
         if (U_FAILURE(status)) {
             icu_error_set(error, FATAL, status, "uregex_start");
             return ENGINE_FAILURE;
         }
+        if (l >= to) {
+            break;
+        }
         u = uregex_end(p->uregex, 0, &status);
         if (U_FAILURE(status)) {
             icu_error_set(error, FATAL, status, "uregex_end");
@@ -156,7 +161,7 @@ static engine_return_t engine_re_match_all(error_t **error, void *data, const US
         }
     }
     if (U_FAILURE(status)) {
-        icu_error_set(error, FATAL, status, "uregex_findNext");
+        icu_error_set(error, FATAL, status, "uregex_[find|findNext]");
         return ENGINE_FAILURE;
     }
     re_pattern_reset(p);
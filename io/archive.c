@@ -0,0 +1,588 @@
+#include <sys/types.h>
+#include <errno.h>
+
+#include "common.h"
+
+/**
+ * Members of archives (tar and cpio, compressed or not), read in a single
+ * pass: each regular file is presented as an input of its own, named
+ * "archive:path", whose bytes are read from the underlying implementation
+ * (the decompressor of the archive, for example) up to the end of its
+ * data. What is left of a member which is not read till its end (a match
+ * with -l) is skipped when moving to the next one.
+ *
+ * Recognized formats:
+ * - tar: v7, ustar, GNU (long names) and pax (path and size records)
+ * - cpio: new ASCII (070701, 070702) and portable ASCII (070707)
+ *
+ * An input which is not recognized as an archive is presented as a single
+ * member, under its own name.
+ **/
+
+enum {
+    FORMAT_NONE,
+    FORMAT_TAR,
+    FORMAT_CPIO_NEWC,
+    FORMAT_CPIO_ODC
+};
+
+#define TAR_BLOCK_SIZE 512
+#define CPIO_NEWC_HEADER_SIZE 110
+#define CPIO_ODC_HEADER_SIZE 76
+#define CPIO_TRAILER "TRAILER!!!"
+
+/* beginning of a member kept to rewind it (charset and binary detection) */
+#define ARCHIVE_REPLAY_SIZE (64 * 1024)
+
+typedef struct {
+    const reader_imp_t *imp;
+    void *fp;
+    const char *filename;
+    int format;
+    UBool done;           /* the end of the archive was met */
+    uint64_t remaining;   /* bytes of the current member not read yet */
+    uint64_t padding;     /* bytes which follow them, up to the next header */
+    char *name;           /* "filename:path" of the current member */
+    size_t name_size;
+    char *path;           /* path set by a GNU long name or a pax header for the next member */
+    size_t path_size;
+    UBool has_path;
+    int64_t pax_size;     /* -1 if the next member has no pax size record */
+    struct {
+        char buffer[TAR_BLOCK_SIZE];
+        size_t ptr;
+        size_t end;
+    } ahead;              /* bytes read to recognize the format */
+    struct {
+        char *buffer;
+        size_t ptr;
+        size_t length;
+        UBool overflow;
+    } replay;
+} ARCHIVE;
+
+/**
+ * Read up to len bytes from the underlying implementation, those read to
+ * recognize the format first
+ **/
+static int32_t archive_read(ARCHIVE *this, error_t **error, char *buffer, size_t len)
+{
+    size_t available;
+
+    if (this->ahead.ptr < this->ahead.end) {
+        available = MIN(len, this->ahead.end - this->ahead.ptr);
+        memcpy(buffer, this->ahead.buffer + this->ahead.ptr, available);
+        this->ahead.ptr += available;
+        return available;
+    }
+
+    return this->imp->readBytes(this->fp, error, buffer, len);
+}
+
+/**
+ * Read len bytes, less only at the end of the underlying input
+ * Return -1 on error
+ **/
+static int32_t archive_read_fully(ARCHIVE *this, error_t **error, char *buffer, size_t len)
+{
+    int32_t ret;
+    size_t total;
+
+    for (total = 0; total < len; total += ret) {
+        if (-1 == (ret = archive_read(this, error, buffer + total, len - total))) {
+            return -1;
+        }
+        if (0 == ret) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+static UBool archive_skip(ARCHIVE *this, error_t **error, uint64_t len)
+{
+    int32_t ret;
+    char buffer[8192];
+
+    while (len > 0) {
+        if (-1 == (ret = archive_read(this, error, buffer, MIN(len, sizeof(buffer))))) {
+            return FALSE;
+        }
+        if (0 == ret) {
+            error_set(error, WARN, "%s: unexpected end of archive", this->filename);
+            return FALSE;
+        }
+        len -= ret;
+    }
+
+    return TRUE;
+}
+
+static void archive_set_name(ARCHIVE *this, const char *path, size_t path_len)
+{
+    size_t filename_len;
+
+    filename_len = strlen(this->filename);
+    if (this->name_size < filename_len + 1 + path_len + 1) {
+        this->name_size = filename_len + 1 + path_len + 1;
+        this->name = mem_renew(this->name, *this->name, this->name_size);
+    }
+    memcpy(this->name, this->filename, filename_len);
+    this->name[filename_len] = ':';
+    memcpy(this->name + filename_len + 1, path, path_len);
+    this->name[filename_len + 1 + path_len] = '\0';
+}
+
+/**
+ * Read the len bytes of a GNU long name or pax header, which are a
+ * property of the next member, into this->path
+ **/
+static UBool archive_read_path(ARCHIVE *this, error_t **error, uint64_t len)
+{
+    if (this->path_size < len + 1) {
+        this->path_size = len + 1;
+        this->path = mem_renew(this->path, *this->path, this->path_size);
+    }
+    if (archive_read_fully(this, error, this->path, len) != (int32_t) len) {
+        error_set(error, WARN, "%s: unexpected end of archive", this->filename);
+        return FALSE;
+    }
+    this->path[len] = '\0';
+
+    return TRUE;
+}
+
+/* ========== tar ========== */
+
+static uint64_t tar_number(const char *field, size_t len)
+{
+    size_t i;
+    uint64_t value;
+
+    value = 0;
+    if (0x80 & (unsigned char) field[0]) {
+        /* GNU base-256 for sizes which don't fit in 11 octal digits */
+        value = field[0] & 0x7F;
+        for (i = 1; i < len; i++) {
+            value = (value << 8) | (unsigned char) field[i];
+        }
+    } else {
+        for (i = 0; i < len && ' ' == field[i]; i++)
+            ;
+        for ( ; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+            value = (value << 3) | (field[i] - '0');
+        }
+    }
+
+    return value;
+}
+
+/**
+ * Check the header checksum (sum of its bytes, the checksum field counting
+ * as spaces), which is what recognizes a tar archive, including v7 ones
+ * which have no magic string
+ **/
+static UBool tar_is_header(const char *header)
+{
+    size_t i;
+    uint64_t sum;
+
+    sum = 0;
+    for (i = 0; i < TAR_BLOCK_SIZE; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : (unsigned char) header[i];
+    }
+
+    return sum != 8 * ' ' && sum == tar_number(header + 148, 8);
+}
+
+static size_t tar_strnlen(const char *field, size_t len)
+{
+    const char *nul;
+
+    return NULL == (nul = memchr(field, '\0', len)) ? len : (size_t) (nul - field);
+}
+
+/**
+ * Take the path and size records of a pax extended header, the others
+ * (times, owner, ...) don't matter here
+ **/
+static void tar_parse_pax(ARCHIVE *this, uint64_t len)
+{
+    uint64_t record_len;
+    size_t path_len;
+    char *p, *end, *record, *value, *path;
+
+    path = NULL;
+    path_len = 0;
+    end = this->path + len;
+    /* records are "<length> <key>=<value>\n", length counting the whole record */
+    for (record = this->path; record < end; record += record_len) {
+        for (p = record, record_len = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+            record_len = record_len * 10 + *p - '0';
+        }
+        if (p >= end || ' ' != *p || record_len <= (uint64_t) (p - record) || record_len > (uint64_t) (end - record)) {
+            break;
+        }
+        ++p;
+        if (NULL == (value = memchr(p, '=', record + record_len - p))) {
+            continue;
+        }
+        ++value;
+        if (value - p == sizeof("path") && 0 == memcmp("path=", p, sizeof("path"))) {
+            path = value;
+            path_len = record + record_len - 1 - value;
+        } else if (value - p == sizeof("size") && 0 == memcmp("size=", p, sizeof("size"))) {
+            this->pax_size = strtoll(value, NULL, 10);
+        }
+    }
+    if (NULL != path) {
+        memmove(this->path, path, path_len);
+        this->path[path_len] = '\0';
+        this->has_path = TRUE;
+    }
+}
+
+static const char *tar_next(ARCHIVE *this, error_t **error)
+{
+    char type;
+    uint64_t size;
+    int32_t ret;
+    size_t name_len, prefix_len;
+    char header[TAR_BLOCK_SIZE], path[155 + 1 + 100];
+
+    while (TRUE) {
+        if (-1 == (ret = archive_read_fully(this, error, header, TAR_BLOCK_SIZE))) {
+            return NULL;
+        }
+        if (ret < TAR_BLOCK_SIZE) {
+            if (ret > 0) {
+                error_set(error, WARN, "%s: unexpected end of archive", this->filename);
+            }
+            return NULL;
+        }
+        if (!tar_is_header(header)) {
+            /* the end of the archive is marked by zeroed blocks */
+            if ('\0' != header[0]) {
+                error_set(error, WARN, "%s: invalid tar header", this->filename);
+            }
+            return NULL;
+        }
+        type = header[156];
+        if (this->pax_size >= 0 && 'L' != type && 'x' != type) {
+            size = this->pax_size;
+        } else {
+            size = tar_number(header + 124, 12);
+        }
+        this->padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        switch (type) {
+            case 'L':
+            case 'x':
+                /* the header describes the next member */
+                if (!archive_read_path(this, error, size) || !archive_skip(this, error, this->padding)) {
+                    return NULL;
+                }
+                if ('L' == type) {
+                    this->has_path = TRUE;
+                } else {
+                    tar_parse_pax(this, size);
+                }
+                break;
+            case '0':
+            case '\0':
+            case '7':
+                if (this->has_path) {
+                    archive_set_name(this, this->path, strlen(this->path));
+                } else {
+                    name_len = tar_strnlen(header, 100);
+                    prefix_len = 0;
+                    if (0 == memcmp(header + 257, "ustar", 5)) {
+                        /* ustar: a prefix of the path may be stored apart */
+                        if (0 != (prefix_len = tar_strnlen(header + 345, 155))) {
+                            memcpy(path, header + 345, prefix_len);
+                            path[prefix_len++] = '/';
+                        }
+                    }
+                    memcpy(path + prefix_len, header, name_len);
+                    archive_set_name(this, path, prefix_len + name_len);
+                }
+                this->has_path = FALSE;
+                this->pax_size = -1;
+                this->remaining = size;
+                return this->name;
+            default:
+                /* directories, links, devices, global pax headers, ... */
+                this->has_path = FALSE;
+                this->pax_size = -1;
+                if (!archive_skip(this, error, size + this->padding)) {
+                    return NULL;
+                }
+                break;
+        }
+    }
+}
+
+/* ========== cpio ========== */
+
+static uint64_t cpio_number(const char *field, size_t len, int base)
+{
+    size_t i;
+    int digit;
+    uint64_t value;
+
+    value = 0;
+    for (i = 0; i < len; i++) {
+        if (field[i] >= '0' && field[i] <= '9') {
+            digit = field[i] - '0';
+        } else if (field[i] >= 'a' && field[i] <= 'f') {
+            digit = field[i] - 'a' + 10;
+        } else if (field[i] >= 'A' && field[i] <= 'F') {
+            digit = field[i] - 'A' + 10;
+        } else {
+            break;
+        }
+        if (digit >= base) {
+            break;
+        }
+        value = value * base + digit;
+    }
+
+    return value;
+}
+
+static const char *cpio_next(ARCHIVE *this, error_t **error)
+{
+    UBool newc;
+    int32_t ret;
+    size_t header_size;
+    uint64_t mode, size, name_len;
+    char header[CPIO_NEWC_HEADER_SIZE];
+
+    newc = FORMAT_CPIO_NEWC == this->format;
+    header_size = newc ? CPIO_NEWC_HEADER_SIZE : CPIO_ODC_HEADER_SIZE;
+    while (TRUE) {
+        if (-1 == (ret = archive_read_fully(this, error, header, header_size))) {
+            return NULL;
+        }
+        if ((size_t) ret < header_size || 0 != memcmp(header, "0707", 4) || !(newc ? ('1' == header[5] || '2' == header[5]) : '7' == header[5])) {
+            error_set(error, WARN, "%s: %s", this->filename, ret > 0 ? "invalid cpio header" : "unexpected end of archive");
+            return NULL;
+        }
+        if (newc) {
+            mode = cpio_number(header + 14, 8, 16);
+            size = cpio_number(header + 54, 8, 16);
+            name_len = cpio_number(header + 94, 8, 16);
+        } else {
+            mode = cpio_number(header + 18, 6, 8);
+            name_len = cpio_number(header + 59, 6, 8);
+            size = cpio_number(header + 65, 11, 8);
+        }
+        /* the name (NUL included) and data are aligned on 4 bytes in new ASCII format */
+        if (!archive_read_path(this, error, name_len) || (newc && !archive_skip(this, error, (4 - (header_size + name_len) % 4) % 4))) {
+            return NULL;
+        }
+        this->padding = newc ? (4 - size % 4) % 4 : 0;
+        if (0 == strcmp(CPIO_TRAILER, this->path)) {
+            return NULL;
+        }
+        if (0100000 == (mode & 0170000)) {
+            archive_set_name(this, this->path, strlen(this->path));
+            this->remaining = size;
+            return this->name;
+        }
+        if (!archive_skip(this, error, size + this->padding)) {
+            return NULL;
+        }
+    }
+}
+
+/* ========== public functions ========== */
+
+/**
+ * Start reading the archive which fp (opened by imp) is, the format is
+ * recognized on its first bytes
+ * Return NULL on error
+ **/
+void *archive_open(error_t **error, const reader_imp_t *imp, void *fp, const char *filename)
+{
+    int32_t ret;
+    ARCHIVE *this;
+
+    this = mem_new(*this);
+    this->imp = imp;
+    this->fp = fp;
+    this->filename = filename;
+    this->done = FALSE;
+    this->remaining = this->padding = 0;
+    this->name = this->path = NULL;
+    this->name_size = this->path_size = 0;
+    this->has_path = FALSE;
+    this->pax_size = -1;
+    this->replay.buffer = NULL;
+    this->replay.ptr = this->replay.length = 0;
+    this->replay.overflow = FALSE;
+    this->ahead.ptr = this->ahead.end = 0;
+    if (-1 == (ret = archive_read_fully(this, error, this->ahead.buffer, sizeof(this->ahead.buffer)))) {
+        free(this);
+        return NULL;
+    }
+    this->ahead.end = ret;
+    if (ret >= 6 && (0 == memcmp(this->ahead.buffer, "070701", 6) || 0 == memcmp(this->ahead.buffer, "070702", 6))) {
+        this->format = FORMAT_CPIO_NEWC;
+    } else if (ret >= 6 && 0 == memcmp(this->ahead.buffer, "070707", 6)) {
+        this->format = FORMAT_CPIO_ODC;
+    } else if (TAR_BLOCK_SIZE == ret && tar_is_header(this->ahead.buffer)) {
+        this->format = FORMAT_TAR;
+    } else {
+        this->format = FORMAT_NONE;
+    }
+    debug("%s, archive format : %d", filename, this->format);
+
+    return this;
+}
+
+/**
+ * Move to the next regular file of the archive
+ * Return its name ("archive:path"), NULL at the end of the archive or on
+ * error (check error)
+ **/
+const char *archive_next(void *fp, error_t **error)
+{
+    ARCHIVE *this;
+    const char *name;
+
+    this = (ARCHIVE *) fp;
+    if (this->done) {
+        return NULL;
+    }
+    this->replay.ptr = this->replay.length = 0;
+    this->replay.overflow = FALSE;
+    if (FORMAT_NONE == this->format) {
+        /* the whole input, read till its end */
+        this->done = TRUE;
+        return this->filename;
+    }
+    if (!archive_skip(this, error, this->remaining + this->padding)) {
+        this->done = TRUE;
+        return NULL;
+    }
+    this->remaining = this->padding = 0;
+    if (FORMAT_TAR == this->format) {
+        name = tar_next(this, error);
+    } else {
+        name = cpio_next(this, error);
+    }
+    this->done = NULL == name;
+
+    return name;
+}
+
+void archive_close(void *fp)
+{
+    ARCHIVE *this;
+
+    this = (ARCHIVE *) fp;
+    this->imp->close(this->fp);
+    if (NULL != this->name) {
+        free(this->name);
+    }
+    if (NULL != this->path) {
+        free(this->path);
+    }
+    if (NULL != this->replay.buffer) {
+        free(this->replay.buffer);
+    }
+    free(this);
+}
+
+/* ========== reader implementation for the current member ========== */
+
+static UBool archive_eof(void *fp)
+{
+    ARCHIVE *this;
+
+    this = (ARCHIVE *) fp;
+    if (this->replay.ptr < this->replay.length) {
+        return FALSE;
+    }
+    if (FORMAT_NONE == this->format) {
+        return this->ahead.ptr == this->ahead.end && this->imp->eof(this->fp);
+    }
+
+    return 0 == this->remaining;
+}
+
+static UBool archive_rewindTo(void *fp, error_t **error, int32_t signature_length)
+{
+    ARCHIVE *this;
+
+    this = (ARCHIVE *) fp;
+    if (this->replay.overflow || (size_t) signature_length > this->replay.length) {
+        error_set(error, WARN, "%s: can't rewind an archive member", this->filename);
+        return FALSE;
+    }
+    this->replay.ptr = signature_length;
+
+    return TRUE;
+}
+
+static int32_t archive_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    int32_t ret;
+    ARCHIVE *this;
+
+    this = (ARCHIVE *) fp;
+    if (this->replay.ptr < this->replay.length) {
+        ret = MIN(max_len, this->replay.length - this->replay.ptr);
+        memcpy(buffer, this->replay.buffer + this->replay.ptr, ret);
+        this->replay.ptr += ret;
+        return ret;
+    }
+    if (FORMAT_NONE != this->format) {
+        if (0 == this->remaining) {
+            return 0;
+        }
+        max_len = MIN(max_len, this->remaining);
+    }
+    if (-1 == (ret = archive_read(this, error, buffer, max_len))) {
+        return -1;
+    }
+    if (FORMAT_NONE != this->format) {
+        if (0 == ret) {
+            error_set(error, WARN, "%s: unexpected end of archive", this->filename);
+            this->remaining = this->padding = 0;
+            this->done = TRUE;
+            return -1;
+        }
+        this->remaining -= ret;
+    }
+    if (!this->replay.overflow) {
+        if (this->replay.length + ret > ARCHIVE_REPLAY_SIZE) {
+            this->replay.overflow = TRUE;
+        } else {
+            if (NULL == this->replay.buffer) {
+                this->replay.buffer = mem_new_n(*this->replay.buffer, ARCHIVE_REPLAY_SIZE);
+            }
+            memcpy(this->replay.buffer + this->replay.length, buffer, ret);
+            this->replay.ptr = this->replay.length += ret;
+        }
+    }
+
+    return ret;
+}
+
+reader_imp_t archive_reader_imp =
+{
+    TRUE,
+    "archive",
+    NULL,
+#ifdef DYNAMIC_READERS
+    NULL,
+#endif /* DYNAMIC_READERS */
+    NULL,
+    NULL,
+    archive_eof,
+    archive_readBytes
+    , archive_rewindTo
+    , NULL
+};
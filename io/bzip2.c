@@ -1,15 +1,42 @@
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <bzlib.h>
 #include <errno.h>
 
 #include "common.h"
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+/**
+ * bzip2 files are read with BZ2_bzRead, stream after stream (files
+ * written by pbzip2 or lbzip2 are made of several streams), except
+ * when more than one thread is allowed (--threads).
+ *
+ * A bzip2 stream is a series of independent blocks, each one starting
+ * with a 48 bits magic number (not byte aligned). As lbzip2 does, the
+ * input is scanned for these magic numbers and each block, turned into
+ * a stream of its own, is decompressed by a worker thread while the
+ * output of the previous ones is consumed, in order.
+ *
+ * The magic number of a block may also appear, by chance, inside a
+ * block: such a block is split in parts which fail to be decompressed.
+ * In this case, they are joined back and decompressed again (by the
+ * reading thread).
+ **/
+
 typedef struct {
     UBool eof;
+    UBool fresh;     /* a new stream was just opened, nothing read from it */
     FILE *f;
 //     int fd;
     BZFILE *fp;
+    char unused[BZ_MAX_UNUSED]; /* bytes read past the end of the previous stream */
+#ifdef HAVE_PTHREAD
+    struct BZIP2_BLOCKS *blocks; /* NULL if blocks are not decompressed in parallel */
+#endif /* HAVE_PTHREAD */
 } BZIP2;
 
 #ifdef DYNAMIC_READERS
@@ -17,6 +44,12 @@ static const char *(*DRNS(BZ2_bzerror))(BZFILE *, int *) = NULL;
 static BZFILE *(*DRNS(BZ2_bzReadOpen))(int *, FILE *, int, int, void *, int) = NULL;
 static int (*DRNS(BZ2_bzRead))(int *, BZFILE *, void *, int) = NULL;
 static void (*DRNS(BZ2_bzReadClose))(int *, BZFILE *) = NULL;
+static void (*DRNS(BZ2_bzReadGetUnused))(int *, BZFILE *, void **, int *) = NULL;
+# ifdef HAVE_PTHREAD
+static int (*DRNS(BZ2_bzDecompressInit))(bz_stream *, int, int) = NULL;
+static int (*DRNS(BZ2_bzDecompress))(bz_stream *) = NULL;
+static int (*DRNS(BZ2_bzDecompressEnd))(bz_stream *) = NULL;
+# endif /* HAVE_PTHREAD */
 
 static UBool bzip2_trydload(void)
 {
@@ -35,12 +68,543 @@ static UBool bzip2_trydload(void)
     DL_GET_SYM(handle, DRNS(BZ2_bzReadOpen), "BZ2_bzReadOpen");
     DL_GET_SYM(handle, DRNS(BZ2_bzRead), "BZ2_bzRead");
     DL_GET_SYM(handle, DRNS(BZ2_bzReadClose), "BZ2_bzReadClose");
+    DL_GET_SYM(handle, DRNS(BZ2_bzReadGetUnused), "BZ2_bzReadGetUnused");
+# ifdef HAVE_PTHREAD
+    DL_GET_SYM(handle, DRNS(BZ2_bzDecompressInit), "BZ2_bzDecompressInit");
+    DL_GET_SYM(handle, DRNS(BZ2_bzDecompress), "BZ2_bzDecompress");
+    DL_GET_SYM(handle, DRNS(BZ2_bzDecompressEnd), "BZ2_bzDecompressEnd");
+# endif /* HAVE_PTHREAD */
     env_register_resource(handle, (func_dtor_t) DL_UNLOAD);
 
     return TRUE;
 }
 #endif /* DYNAMIC_READERS */
 
+#ifdef HAVE_PTHREAD
+# define BZIP2_INPUT_SIZE (4 * 1024 * 1024)     /* compressed bytes read at once */
+# define BZIP2_MAX_BLOCK_SIZE (3 * 1024 * 1024) /* bound of a compressed block (900k symbols of at most 20 bits + tables) */
+# define BZIP2_BLOCKS_BY_THREAD 2
+# ifdef DEBUG
+#  define BZIP2_MIN_SIZE 0
+# else
+#  define BZIP2_MIN_SIZE (1024 * 1024)          /* smaller files are not worth starting threads */
+# endif /* DEBUG */
+
+# define BZIP2_BLOCK_MAGIC UINT64_C(0x314159265359)
+# define BZIP2_EOS_MAGIC   UINT64_C(0x177245385090)
+# define BZIP2_MAGIC_MASK  UINT64_C(0xFFFFFFFFFFFF)
+
+enum {
+    BLOCK_OK,
+    BLOCK_READ_ERROR,   /* invalid or truncated input, found while scanning */
+    BLOCK_DECODE_ERROR  /* block can't be decompressed */
+};
+
+typedef struct {
+    UBool done;          /* decompressed (or failed) */
+    int status;
+    const char *error;   /* reason when status is not BLOCK_OK */
+    int level;           /* block size (1 to 9) of the stream */
+    int shift;           /* position of the first bit of the block in in[0] */
+    size_t nbits;        /* length of the block, in bits */
+    size_t in_len, in_size;
+    size_t out_len, out_size;
+    size_t stream_size;
+    uint8_t *in;         /* bytes which hold the bits of the block */
+    char *out;
+    char *stream;        /* the block, as a stream of its own */
+} BLOCK;
+
+struct BZIP2_BLOCKS {
+    int fd;
+    int level;           /* of the current stream, 0 before a stream header */
+    UBool exhausted;     /* no more block to read */
+    struct {
+        uint8_t *buffer;
+        size_t bit;      /* position of the next block (or stream header) */
+        size_t len;
+        UBool eof;
+    } input;
+    /* block of sequence number n is blocks[n % count] */
+    size_t count;
+    size_t current;      /* block being consumed */
+    size_t next;         /* next block to decompress */
+    size_t filled;       /* next block to read */
+    const char *ptr;     /* into the output of the current block, NULL if not yet waited for */
+    BLOCK *blocks;
+    UBool stop;
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work; /* a block was read or the workers have to stop */
+    pthread_cond_t done; /* a block was decompressed */
+};
+
+typedef struct BZIP2_BLOCKS BZIP2_BLOCKS;
+
+/**
+ * Get the n (<= 57) bits at bit position pos of p
+ **/
+static uint64_t get_bits(const uint8_t *p, size_t pos, int n)
+{
+    int i;
+    uint64_t v;
+
+    v = 0;
+    p += pos / 8;
+    for (i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+
+    return (v >> (64 - (pos % 8) - n)) & ((UINT64_C(1) << n) - 1);
+}
+
+/**
+ * Find the first block or end of stream magic number in [from;to[ (positions in bits)
+ * Return its position or (size_t) -1
+ **/
+static size_t find_magic(const uint8_t *p, size_t from, size_t to)
+{
+    int k;
+    size_t i, pos;
+    uint64_t w, v;
+
+    w = 0;
+    for (i = from / 8; i < to / 8; i++) {
+        w = (w << 8) | p[i];
+        if (8 * i < from + 40) {
+            continue;
+        }
+        /* magic numbers ending in byte i, in order of their positions */
+        for (k = 7; k >= 0; k--) {
+            v = (w >> k) & BZIP2_MAGIC_MASK;
+            if (BZIP2_BLOCK_MAGIC == v || BZIP2_EOS_MAGIC == v) {
+                pos = 8 * i - 40 - k;
+                if (pos >= from && pos + 48 <= to) {
+                    return pos;
+                }
+            }
+        }
+    }
+
+    return (size_t) -1;
+}
+
+/**
+ * Append the n lower bits of v at bit position *pos of p
+ **/
+static void put_bits(char *p, size_t *pos, uint64_t v, int n)
+{
+    while (n-- > 0) {
+        if (0 != ((v >> n) & 1)) {
+            p[*pos / 8] |= 0x80 >> (*pos % 8);
+        }
+        ++*pos;
+    }
+}
+
+/**
+ * Decompress a block: it is turned into a stream of its own (header,
+ * block, end of stream with the CRC of the block as combined CRC)
+ **/
+static void bzip2_decode_block(BLOCK *block)
+{
+    int ret;
+    bz_stream strm;
+    size_t i, len, pos;
+
+    len = 4 + (block->nbits + 7) / 8 + 10 + 1;
+    if (len > block->stream_size) {
+        block->stream = mem_renew(block->stream, *block->stream, len);
+        block->stream_size = len;
+    }
+    memset(block->stream, 0, len);
+    memcpy(block->stream, "BZh", 3);
+    block->stream[3] = '0' + block->level;
+    for (i = 0; i < (block->nbits + 7) / 8; i++) {
+        block->stream[4 + i] = (block->in[i] << block->shift) | (i + 1 < block->in_len ? block->in[i + 1] >> (8 - block->shift) : 0);
+    }
+    if (0 != block->nbits % 8) {
+        block->stream[4 + block->nbits / 8] &= 0xFF << (8 - block->nbits % 8);
+    }
+    pos = 32 + block->nbits;
+    put_bits(block->stream, &pos, BZIP2_EOS_MAGIC, 48);
+    put_bits(block->stream, &pos, get_bits(block->in, block->shift + 48, 32), 32);
+
+    block->status = BLOCK_DECODE_ERROR;
+    memset(&strm, 0, sizeof(strm));
+    if (BZ_OK != (ret = DRNS(BZ2_bzDecompressInit)(&strm, 0, 0))) {
+        block->error = "BZ2_bzDecompressInit() failed";
+        return;
+    }
+    strm.next_in = block->stream;
+    strm.avail_in = (pos + 7) / 8;
+    block->out_len = 0;
+    do {
+        if (block->out_len == block->out_size) {
+            block->out_size = 0 == block->out_size ? (size_t) block->level * 100000 : block->out_size * 2;
+            block->out = mem_renew(block->out, *block->out, block->out_size);
+        }
+        strm.next_out = block->out + block->out_len;
+        strm.avail_out = block->out_size - block->out_len;
+        ret = DRNS(BZ2_bzDecompress)(&strm);
+        block->out_len = block->out_size - strm.avail_out;
+    } while (BZ_OK == ret && (strm.avail_in > 0 || 0 == strm.avail_out));
+    DRNS(BZ2_bzDecompressEnd)(&strm);
+    if (BZ_STREAM_END == ret) {
+        block->status = BLOCK_OK;
+        block->error = NULL;
+    } else {
+        block->error = BZ_OK == ret ? "unexpected end of block" : "invalid block";
+    }
+}
+
+static void *bzip2_worker(void *data)
+{
+    BLOCK *block;
+    BZIP2_BLOCKS *this;
+
+    this = (BZIP2_BLOCKS *) data;
+    pthread_mutex_lock(&this->mutex);
+    while (TRUE) {
+        while (!this->stop && this->next == this->filled) {
+            pthread_cond_wait(&this->work, &this->mutex);
+        }
+        if (this->stop) {
+            break;
+        }
+        block = &this->blocks[this->next++ % this->count];
+        pthread_mutex_unlock(&this->mutex);
+        if (BLOCK_OK == block->status) {
+            bzip2_decode_block(block);
+        }
+        pthread_mutex_lock(&this->mutex);
+        block->done = TRUE;
+        pthread_cond_broadcast(&this->done);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+
+/**
+ * Make at least wanted bytes, from the current position, available in the
+ * input buffer (less at end of file)
+ * Return the number of available bytes, -1 on error
+ **/
+static ssize_t bzip2_input_ensure(BZIP2_BLOCKS *this, error_t **error, size_t wanted)
+{
+    ssize_t ret;
+    size_t start;
+
+    start = this->input.bit / 8;
+    if (this->input.len - start < wanted && !this->input.eof) {
+        memmove(this->input.buffer, this->input.buffer + start, this->input.len - start);
+        this->input.len -= start;
+        this->input.bit -= 8 * start;
+        start = 0;
+        while (this->input.len < wanted) {
+            if (-1 == (ret = read(this->fd, this->input.buffer + this->input.len, BZIP2_INPUT_SIZE - this->input.len))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                error_set(error, WARN, "read() failed: %s", strerror(errno));
+                return -1;
+            }
+            if (0 == ret) {
+                this->input.eof = TRUE;
+                break;
+            }
+            this->input.len += ret;
+        }
+    }
+
+    return this->input.len - start;
+}
+
+/**
+ * Scan the input for the next block and hand it to the workers
+ * Return FALSE on error, *block is set to NULL if there is no more block
+ **/
+static UBool bzip2_next_block(BZIP2_BLOCKS *this, error_t **error, BLOCK *block, UBool *found)
+{
+    size_t end;
+    ssize_t available;
+    const uint8_t *p;
+
+    *found = FALSE;
+    while (TRUE) {
+        if (-1 == (available = bzip2_input_ensure(this, error, BZIP2_MAX_BLOCK_SIZE))) {
+            return FALSE;
+        }
+        p = this->input.buffer + this->input.bit / 8;
+        if (0 == this->level) {
+            /* a stream header, or the end of the file (trailing garbage is ignored, as bzip2 does) */
+            if (available < 4 || 0 != memcmp(p, "BZh", 3) || p[3] < '1' || p[3] > '9') {
+                this->exhausted = TRUE;
+                return TRUE;
+            }
+            this->level = p[3] - '0';
+            this->input.bit += 32;
+            continue;
+        }
+        if (8 * (size_t) available - this->input.bit % 8 < 48 + 32) {
+            block->status = BLOCK_READ_ERROR;
+            block->error = "unexpected end of file";
+            break;
+        }
+        if (BZIP2_EOS_MAGIC == get_bits(this->input.buffer, this->input.bit, 48)) {
+            /* end of stream: skip the combined CRC and the padding */
+            this->input.bit = (this->input.bit + 48 + 32 + 7) / 8 * 8;
+            this->level = 0;
+            continue;
+        }
+        if (BZIP2_BLOCK_MAGIC != get_bits(this->input.buffer, this->input.bit, 48)) {
+            block->status = BLOCK_READ_ERROR;
+            block->error = "invalid block";
+            break;
+        }
+        if ((size_t) -1 == (end = find_magic(this->input.buffer, this->input.bit + 48, 8 * this->input.len))) {
+            block->status = BLOCK_READ_ERROR;
+            block->error = this->input.eof ? "unexpected end of file" : "invalid block";
+            break;
+        }
+        block->status = BLOCK_OK;
+        block->error = NULL;
+        block->level = this->level;
+        block->shift = this->input.bit % 8;
+        block->nbits = end - this->input.bit;
+        block->in_len = (end + 7) / 8 - this->input.bit / 8;
+        if (block->in_len + 8 > block->in_size) {
+            /* + 8: get_bits reads 8 bytes at once */
+            block->in_size = block->in_len + 8;
+            block->in = mem_renew(block->in, *block->in, block->in_size);
+        }
+        memcpy(block->in, p, block->in_len);
+        memset(block->in + block->in_len, 0, 8);
+        this->input.bit = end;
+        break;
+    }
+    if (BLOCK_READ_ERROR == block->status) {
+        /* nothing can follow */
+        this->exhausted = TRUE;
+    }
+    *found = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * Read blocks in the slots freed by the consumer and hand them to the workers
+ **/
+static UBool bzip2_read_blocks(BZIP2_BLOCKS *this, error_t **error)
+{
+    UBool found;
+    BLOCK *block;
+    size_t filled;
+
+    filled = this->filled;
+    while (!this->exhausted && filled < this->current + this->count) {
+        block = &this->blocks[filled % this->count];
+        if (!bzip2_next_block(this, error, block, &found)) {
+            return FALSE;
+        }
+        if (!found) {
+            break;
+        }
+        block->done = FALSE;
+        ++filled;
+    }
+    if (filled != this->filled) {
+        pthread_mutex_lock(&this->mutex);
+        this->filled = filled;
+        pthread_cond_broadcast(&this->work);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    return TRUE;
+}
+
+static void bzip2_wait_block(BZIP2_BLOCKS *this, BLOCK *block)
+{
+    pthread_mutex_lock(&this->mutex);
+    while (!block->done) {
+        pthread_cond_wait(&this->done, &this->mutex);
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+/**
+ * (Re)start from the beginning of the file, once the blocks in progress are decompressed
+ **/
+static UBool bzip2_blocks_start(BZIP2_BLOCKS *this, error_t **error)
+{
+    pthread_mutex_lock(&this->mutex);
+    for (; this->current < this->filled; this->current++) {
+        while (!this->blocks[this->current % this->count].done) {
+            pthread_cond_wait(&this->done, &this->mutex);
+        }
+    }
+    this->current = this->next = this->filled = 0;
+    pthread_mutex_unlock(&this->mutex);
+    if (((off_t) -1) == lseek(this->fd, 0, SEEK_SET)) {
+        error_set(error, WARN, "lseek() failed: %s", strerror(errno));
+        return FALSE;
+    }
+    this->ptr = NULL;
+    this->level = 0;
+    this->exhausted = FALSE;
+    this->input.bit = this->input.len = 0;
+    this->input.eof = FALSE;
+
+    return bzip2_read_blocks(this, error);
+}
+
+static void bzip2_blocks_close(BZIP2_BLOCKS *this)
+{
+    size_t i;
+
+    pthread_mutex_lock(&this->mutex);
+    this->stop = TRUE;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->mutex);
+    for (i = 0; i < (size_t) this->nthreads; i++) {
+        pthread_join(this->threads[i], NULL);
+    }
+    pthread_cond_destroy(&this->done);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->mutex);
+    for (i = 0; i < this->count; i++) {
+        free(this->blocks[i].in);
+        free(this->blocks[i].out);
+        free(this->blocks[i].stream);
+    }
+    free(this->blocks);
+    free(this->threads);
+    free(this->input.buffer);
+    free(this);
+}
+
+/**
+ * Start the workers if fd is a (regular) file worth it
+ * Return NULL if it is not (or they can't be started)
+ **/
+static BZIP2_BLOCKS *bzip2_blocks_open(int fd)
+{
+    int nthreads;
+    struct stat st;
+    BZIP2_BLOCKS *this;
+
+    if ((nthreads = env_get_threads()) < 2 || -1 == fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < BZIP2_MIN_SIZE) {
+        return NULL;
+    }
+    this = mem_new(*this);
+    memset(this, 0, sizeof(*this));
+    this->fd = fd;
+    this->count = nthreads * BZIP2_BLOCKS_BY_THREAD;
+    this->blocks = mem_new_n(*this->blocks, this->count);
+    memset(this->blocks, 0, sizeof(*this->blocks) * this->count);
+    this->threads = mem_new_n(*this->threads, nthreads);
+    this->input.buffer = mem_new_n(*this->input.buffer, BZIP2_INPUT_SIZE + 8); /* + 8: see get_bits */
+    memset(this->input.buffer, 0, BZIP2_INPUT_SIZE + 8);
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->done, NULL);
+    for (this->nthreads = 0; this->nthreads < nthreads; this->nthreads++) {
+        if (0 != pthread_create(&this->threads[this->nthreads], NULL, bzip2_worker, this)) {
+            break;
+        }
+    }
+    if (0 == this->nthreads) {
+        bzip2_blocks_close(this);
+        return NULL;
+    }
+    debug("%d threads", this->nthreads);
+
+    return this;
+}
+
+/**
+ * The block failed to be decompressed: it may have been split by false
+ * magic numbers. Join it with the next ones until it can be decompressed.
+ **/
+static UBool bzip2_join_blocks(BZIP2_BLOCKS *this, BLOCK *block)
+{
+    size_t n;
+    BLOCK *next;
+    size_t overlap;
+
+    for (n = this->current + 1; BLOCK_OK != block->status && n < this->filled; n++) {
+        next = &this->blocks[n % this->count];
+        bzip2_wait_block(this, next);
+        if (BLOCK_READ_ERROR == next->status) {
+            break;
+        }
+        /* the last byte of block is the first one of next unless the boundary is byte aligned */
+        overlap = 0 != (block->shift + block->nbits) % 8;
+        if (block->in_len - overlap + next->in_len + 8 > block->in_size) {
+            block->in_size = block->in_len - overlap + next->in_len + 8;
+            block->in = mem_renew(block->in, *block->in, block->in_size);
+        }
+        memcpy(block->in + block->in_len - overlap, next->in, next->in_len);
+        block->in_len += next->in_len - overlap;
+        memset(block->in + block->in_len, 0, 8);
+        block->nbits += next->nbits;
+        /* next is now part of block: nothing is left to output for it */
+        next->status = BLOCK_OK;
+        next->out_len = 0;
+        bzip2_decode_block(block);
+    }
+
+    return BLOCK_OK == block->status;
+}
+
+/**
+ * Give the output of the current block, once decompressed
+ * Return the number of bytes, 0 after the last block, -1 on error
+ **/
+static int32_t bzip2_blocks_mapBytes(BZIP2_BLOCKS *this, error_t **error, const char **bytes, size_t max_len)
+{
+    size_t n;
+    BLOCK *block;
+
+    while (this->current < this->filled) {
+        block = &this->blocks[this->current % this->count];
+        if (NULL == this->ptr) {
+            bzip2_wait_block(this, block);
+            if (BLOCK_DECODE_ERROR == block->status) {
+                const char *reason;
+
+                reason = block->error;
+                if (!bzip2_join_blocks(this, block)) {
+                    error_set(error, WARN, "bzip2 internal error from BZ2_bzDecompress(): %s", reason);
+                    return -1;
+                }
+            }
+            if (BLOCK_OK != block->status) {
+                error_set(error, WARN, "bzip2: %s", block->error);
+                return -1;
+            }
+            this->ptr = block->out;
+        }
+        if (this->ptr < block->out + block->out_len) {
+            n = MIN(max_len, (size_t) (block->out + block->out_len - this->ptr));
+            *bytes = this->ptr;
+            this->ptr += n;
+            return n;
+        }
+        /* block consumed: its slot can take the next block to read */
+        this->ptr = NULL;
+        this->current++;
+        if (!bzip2_read_blocks(this, error)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif /* HAVE_PTHREAD */
+
 static void *bzip2_dopen(error_t **error, int fd, const char * const filename)
 {
     BZIP2 *this;
@@ -48,7 +612,20 @@ static void *bzip2_dopen(error_t **error, int fd, const char * const filename)
 
     this = mem_new(*this);
     this->eof = FALSE;
+    this->fresh = FALSE;
+    this->f = NULL;
+    this->fp = NULL;
 //     this->fd = fd;
+#ifdef HAVE_PTHREAD
+    if (NULL != (this->blocks = bzip2_blocks_open(fd))) {
+        if (!bzip2_blocks_start(this->blocks, error)) {
+            bzip2_blocks_close(this->blocks);
+            free(this);
+            return NULL;
+        }
+        return this;
+    }
+#endif /* HAVE_PTHREAD */
     if (STDIN_FILENO == fd) {
         if (feof(stdin)) {
             clearerr(stdin);
@@ -76,7 +653,16 @@ static void bzip2_close(void *fp)
     int bzerror;
 
     this = (BZIP2 *) fp;
-    DRNS(BZ2_bzReadClose)(&bzerror, this->fp);
+#ifdef HAVE_PTHREAD
+    if (NULL != this->blocks) {
+        bzip2_blocks_close(this->blocks);
+        free(this);
+        return;
+    }
+#endif /* HAVE_PTHREAD */
+    if (NULL != this->fp) {
+        DRNS(BZ2_bzReadClose)(&bzerror, this->fp);
+    }
 //     BZ2_bzclose(this->fp);
 //     if (STDIN_FILENO != this->fd) {
     if (fileno(this->f) != STDIN_FILENO) {
@@ -92,51 +678,42 @@ static UBool bzip2_eof(void *fp)
     BZIP2 *this;
 
     this = (BZIP2 *) fp;
+#ifdef HAVE_PTHREAD
+    if (NULL != this->blocks) {
+        return this->blocks->exhausted && this->blocks->current >= this->blocks->filled;
+    }
+#endif /* HAVE_PTHREAD */
 
     return this->eof;
 }
 
-#ifndef NO_PHYSICAL_REWIND
-# define SIG_MAX_LEN 5
-static UBool bzip2_rewindTo(void *fp, error_t **error, int32_t signature_length)
+/**
+ * At the end of a stream, continue with the next one, if any
+ **/
+static UBool bzip2_next_stream(BZIP2 *this, error_t **error)
 {
-    BZIP2 *this;
-    int bzerror;
-    char buffer[SIG_MAX_LEN];
+    int c, bzerror, nUnused;
+    void *unused;
 
-    this = (BZIP2 *) fp;
+    DRNS(BZ2_bzReadGetUnused)(&bzerror, this->fp, &unused, &nUnused);
+    memcpy(this->unused, unused, nUnused);
     DRNS(BZ2_bzReadClose)(&bzerror, this->fp);
-//     BZ2_bzclose(this->fp);
-    this->eof = FALSE;
-    if (0 != fseek(this->f, (long) signature_length, SEEK_SET)) {
-//     if (lseek(this->fd, (long) signature_length, SEEK_SET) < 0) {
-        error_set(error, WARN, "fseek() failed: %s", strerror(errno));
-//         error_set(error, WARN, "lseek failed: %s", strerror(errno));
-        return FALSE;
+    this->fp = NULL;
+    if (0 == nUnused) {
+        if (EOF == (c = getc(this->f))) {
+            this->eof = TRUE;
+            return TRUE;
+        }
+        ungetc(c, this->f);
     }
-    if (NULL == (this->fp = DRNS(BZ2_bzReadOpen)(&bzerror, this->f, 0, 0, NULL, 0))) {
-//     if (NULL == (this->fp = BZ2_bzdopen(this->fd, "rb"))) {
+    if (NULL == (this->fp = DRNS(BZ2_bzReadOpen)(&bzerror, this->f, 0, 0, this->unused, nUnused))) {
         error_set(error, WARN, "bzip2 internal error from BZ2_bzReadOpen()");
-//         error_set(error, WARN, "bzip2 internal error from bzdopen()");
         return FALSE;
     }
-    if (signature_length > 0) {
-        DRNS(BZ2_bzRead)(&bzerror, this->fp, buffer, signature_length);
-        switch (bzerror) {
-            case BZ_OK:
-                break;
-            case BZ_STREAM_END:
-                this->eof = TRUE;
-                break;
-            default:
-                error_set(error, WARN, "bzip2 internal error from BZ2_bzRead(): %s", DRNS(BZ2_bzerror)(this->fp, &bzerror));
-                return FALSE;
-        }
-    }
+    this->fresh = TRUE;
 
     return TRUE;
 }
-#endif /* !NO_PHYSICAL_REWIND */
 
 static int32_t bzip2_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
 {
@@ -145,17 +722,46 @@ static int32_t bzip2_readBytes(void *fp, error_t **error, char *buffer, size_t m
     int bzerror;
 
     this = (BZIP2 *) fp;
+#ifdef HAVE_PTHREAD
+    if (NULL != this->blocks) {
+        int32_t n;
+        const char *bytes;
+
+        for (ret = 0; (size_t) ret < max_len; ret += n) {
+            if (-1 == (n = bzip2_blocks_mapBytes(this->blocks, error, &bytes, max_len - ret))) {
+                return -1;
+            }
+            if (0 == n) {
+                break;
+            }
+            memcpy(buffer + ret, bytes, n);
+        }
+        return ret;
+    }
+#endif /* HAVE_PTHREAD */
     if (this->eof) {
         return 0;
     }
     ret = DRNS(BZ2_bzRead)(&bzerror, this->fp, buffer, max_len);
 //     ret = BZ2_bzread(this->fp, buffer, max_len);
+    if (ret > 0) {
+        this->fresh = FALSE;
+    }
     switch (bzerror) {
         case BZ_OK:
             break;
         case BZ_STREAM_END:
-            this->eof = TRUE;
+            if (!bzip2_next_stream(this, error)) {
+                return -1;
+            }
             break;
+        case BZ_DATA_ERROR_MAGIC:
+            if (this->fresh) {
+                /* trailing garbage after a stream: ignored, as bzip2 does */
+                this->eof = TRUE;
+                return 0;
+            }
+            /* FALLTHROUGH */
         default:
             error_set(error, WARN, "bzip2 internal error from BZ2_bzRead(): %s", DRNS(BZ2_bzerror)(this->fp, &bzerror));
             return -1;
@@ -164,13 +770,53 @@ static int32_t bzip2_readBytes(void *fp, error_t **error, char *buffer, size_t m
     return ret;
 }
 
+# define SIG_MAX_LEN 5
+static UBool bzip2_rewindTo(void *fp, error_t **error, int32_t signature_length)
+{
+    BZIP2 *this;
+    int bzerror;
+    char buffer[SIG_MAX_LEN];
+
+    this = (BZIP2 *) fp;
+#ifdef HAVE_PTHREAD
+    if (NULL != this->blocks) {
+        if (!bzip2_blocks_start(this->blocks, error)) {
+            return FALSE;
+        }
+        return 0 == signature_length || signature_length == bzip2_readBytes(fp, error, buffer, MIN(signature_length, SIG_MAX_LEN));
+    }
+#endif /* HAVE_PTHREAD */
+    if (NULL != this->fp) {
+        DRNS(BZ2_bzReadClose)(&bzerror, this->fp);
+    }
+//     BZ2_bzclose(this->fp);
+    this->eof = FALSE;
+    this->fresh = FALSE;
+    /* the signature is in the decompressed data: start over from the beginning of the file */
+    if (0 != fseek(this->f, 0L, SEEK_SET)) {
+//     if (lseek(this->fd, (long) signature_length, SEEK_SET) < 0) {
+        error_set(error, WARN, "fseek() failed: %s", strerror(errno));
+//         error_set(error, WARN, "lseek failed: %s", strerror(errno));
+        return FALSE;
+    }
+    if (NULL == (this->fp = DRNS(BZ2_bzReadOpen)(&bzerror, this->f, 0, 0, NULL, 0))) {
+//     if (NULL == (this->fp = BZ2_bzdopen(this->fd, "rb"))) {
+        error_set(error, WARN, "bzip2 internal error from BZ2_bzReadOpen()");
+//         error_set(error, WARN, "bzip2 internal error from bzdopen()");
+        return FALSE;
+    }
+    if (signature_length > 0) {
+        return signature_length == bzip2_readBytes(fp, error, buffer, MIN(signature_length, SIG_MAX_LEN));
+    }
+
+    return TRUE;
+}
+
 reader_imp_t bzip2_reader_imp =
 {
     FALSE,
     "bzip2",
-#if 0
     "BZh",
-#endif
 #ifdef DYNAMIC_READERS
     bzip2_trydload,
 #endif /* DYNAMIC_READERS */
@@ -178,7 +824,6 @@ reader_imp_t bzip2_reader_imp =
     bzip2_close,
     bzip2_eof,
     bzip2_readBytes
-#ifndef NO_PHYSICAL_REWIND
     , bzip2_rewindTo
-#endif /* !NO_PHYSICAL_REWIND */
+    , NULL
 };
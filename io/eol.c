@@ -0,0 +1,106 @@
+#include "common.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif /* __SSE2__ */
+
+/**
+ * Look for the next end of line candidate, by 8 UChars or 16 bytes
+ * with SSE2. Candidates are first units of an end of line, the caller
+ * still has to handle CR LF pairs and sequences cut by the end of the
+ * buffer.
+ **/
+
+/**
+ * Return the first of CR, LF, VT, FF, NEL, LS or PS in [p;end[, end if none
+ **/
+const UChar *utf16_find_eol(const UChar *p, const UChar *end) /* NONNULL() */
+{
+#ifdef __SSE2__
+    int mask;
+    __m128i chunk;
+    const __m128i one = _mm_set1_epi16(0x0001);
+    const __m128i nl = _mm_set1_epi16(U_NL);
+    const __m128i ps = _mm_set1_epi16(U_PS);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lf = _mm_set1_epi16(U_LF);
+    const __m128i cr_lf = _mm_set1_epi16(U_CR - U_LF);
+
+    while (end - p >= 8) {
+        chunk = _mm_loadu_si128((const __m128i *) p);
+        /* LF <= c <= CR (U_LF, U_VT, U_FF, U_CR): saturated c - LF - (CR - LF) is 0 */
+        mask = _mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(chunk, lf), cr_lf), zero),
+                    _mm_cmpeq_epi16(chunk, nl)
+                ),
+                _mm_cmpeq_epi16(_mm_or_si128(chunk, one), ps) /* U_LS | 1 == U_PS */
+            )
+        );
+        if (0 != mask) {
+            break;
+        }
+        p += 8;
+    }
+#endif /* __SSE2__ */
+    for ( ; p < end; p++) {
+        switch (*p) {
+            case U_CR:
+            case U_LF:
+            case U_VT:
+            case U_FF:
+            case U_NL:
+            case U_LS:
+            case U_PS:
+                return p;
+        }
+    }
+
+    return end;
+}
+
+/**
+ * UTF-8 counterpart of utf16_find_eol: return the first of \n, \v, \f, \r
+ * or lead byte of NEL (C2) and LS/PS (E2) in [p;end[, end if none
+ **/
+const char *utf8_find_eol(const char *p, const char *end) /* NONNULL() */
+{
+    const uint8_t *s;
+#ifdef __SSE2__
+    int mask;
+    __m128i chunk;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lf = _mm_set1_epi8(0x0A);
+    const __m128i cr_lf = _mm_set1_epi8(0x0D - 0x0A);
+    const __m128i c2 = _mm_set1_epi8((char) 0xC2);
+    const __m128i e2 = _mm_set1_epi8((char) 0xE2);
+#endif /* __SSE2__ */
+
+    s = (const uint8_t *) p;
+#ifdef __SSE2__
+    while (end - (const char *) s >= 16) {
+        chunk = _mm_loadu_si128((const __m128i *) s);
+        mask = _mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(chunk, lf), cr_lf), zero),
+                    _mm_cmpeq_epi8(chunk, c2)
+                ),
+                _mm_cmpeq_epi8(chunk, e2)
+            )
+        );
+        if (0 != mask) {
+            break;
+        }
+        s += 16;
+    }
+#endif /* __SSE2__ */
+    for ( ; (const char *) s < end; s++) {
+        if ((*s >= 0x0A && *s <= 0x0D) || 0xC2 == *s || 0xE2 == *s) {
+            break;
+        }
+    }
+
+    return (const char *) s;
+}
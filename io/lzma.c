@@ -5,10 +5,25 @@
 
 #include "common.h"
 
+/**
+ * When more than one thread is allowed (--threads) and liblzma has it
+ * (5.4 and later), the multithreaded decoder is used: the blocks of xz
+ * files written by xz -T (or with --block-size) are then decoded in
+ * parallel. Files of a single block are still decoded by one thread.
+ *
+ * Its memory usage is bounded by --memlimit, a quarter of the physical
+ * memory by default (as xz does). Past this limit, it falls back to a
+ * single thread instead of failing.
+ **/
+#if LZMA_VERSION >= UINT32_C(50040002)
+# define HAVE_LZMA_MT 1
+#endif /* liblzma >= 5.4.0 */
+
 typedef struct {
     int fd;
     UBool eof;
     lzma_stream strm;
+    uint8_t in_buf[BUFSIZ];
 } LZMA;
 
 static const char *lzma_strerror(lzma_ret ret)
@@ -44,9 +59,14 @@ static const char *lzma_strerror(lzma_ret ret)
 }
 
 #ifdef DYNAMIC_READERS
-static const char *(*DRNS(lzma_stream_decoder))(lzma_stream *, uint64_t, uint32_t) = NULL;
+static lzma_ret (*DRNS(lzma_stream_decoder))(lzma_stream *, uint64_t, uint32_t) = NULL;
 static lzma_ret (*DRNS(lzma_code))(lzma_stream *, lzma_action) = NULL;
 static void (*DRNS(lzma_end))(lzma_stream *strm) = NULL;
+# ifdef HAVE_LZMA_MT
+/* optional: NULL if the library is too old */
+static lzma_ret (*DRNS(lzma_stream_decoder_mt))(lzma_stream *, const lzma_mt *) = NULL;
+static uint64_t (*DRNS(lzma_physmem))(void) = NULL;
+# endif /* HAVE_LZMA_MT */
 
 static UBool lzma_trydload(void)
 {
@@ -64,12 +84,45 @@ static UBool lzma_trydload(void)
     DL_GET_SYM(handle, DRNS(lzma_stream_decoder), "lzma_stream_decoder");
     DL_GET_SYM(handle, DRNS(lzma_code), "lzma_code");
     DL_GET_SYM(handle, DRNS(lzma_end), "lzma_end");
+# ifdef HAVE_LZMA_MT
+    *(void **) &DRNS(lzma_stream_decoder_mt) = DL_FETCH_SYMBOL(handle, "lzma_stream_decoder_mt");
+    *(void **) &DRNS(lzma_physmem) = DL_FETCH_SYMBOL(handle, "lzma_physmem");
+# endif /* HAVE_LZMA_MT */
     env_register_resource(handle, (func_dtor_t) DL_UNLOAD);
 
     return TRUE;
 }
 #endif /* DYNAMIC_READERS */
 
+/**
+ * Initialize (or reinitialize) the decoder of strm
+ **/
+static lzma_ret lzma_decoder_init(lzma_stream *strm)
+{
+#ifdef HAVE_LZMA_MT
+    if (env_get_threads() > 1
+# ifdef DYNAMIC_READERS
+        && NULL != DRNS(lzma_stream_decoder_mt) && NULL != DRNS(lzma_physmem)
+# endif /* DYNAMIC_READERS */
+    ) {
+        lzma_mt mt;
+
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = env_get_threads();
+        if (0 == (mt.memlimit_threading = env_get_memlimit())) {
+            /* lzma_physmem returns 0 if it can't tell */
+            if (0 == (mt.memlimit_threading = DRNS(lzma_physmem)() / 4)) {
+                mt.memlimit_threading = UINT64_C(1) << 30;
+            }
+        }
+        mt.memlimit_stop = UINT64_MAX;
+        return DRNS(lzma_stream_decoder_mt)(strm, &mt);
+    }
+#endif /* HAVE_LZMA_MT */
+
+    return DRNS(lzma_stream_decoder)(strm, UINT64_MAX, 0);
+}
+
 static void *lzma_dopen(error_t **error, int fd, const char * const UNUSED(filename))
 {
     LZMA *this;
@@ -80,8 +133,8 @@ static void *lzma_dopen(error_t **error, int fd, const char * const UNUSED(filen
     this->fd = fd;
     this->eof = FALSE;
     this->strm = null_strm;
-    if (LZMA_OK != (r = DRNS(lzma_stream_decoder)(&this->strm, UINT64_MAX, 0))) {
-        error_set(error, WARN, "lzma internal error from lzma_stream_decoder()", lzma_strerror(r));
+    if (LZMA_OK != (r = lzma_decoder_init(&this->strm))) {
+        error_set(error, WARN, "lzma internal error from lzma_stream_decoder(): %s", lzma_strerror(r));
         free(this);
         return NULL;
     }
@@ -108,55 +161,72 @@ static UBool lzma_eof(void *fp)
     return this->eof;
 }
 
-#ifndef NO_PHYSICAL_REWIND
 # define SIG_MAX_LEN 5
+static int32_t lzma_readBytes(void *, error_t **, char *, size_t);
+
 static UBool lzma_rewindTo(void *fp, error_t **error, int32_t signature_length)
 {
     LZMA *this;
+    lzma_ret r;
+    char sig[SIG_MAX_LEN];
+    lzma_stream null_strm = LZMA_STREAM_INIT;
 
     this = (LZMA *) fp;
-    if (((off_t) -1) == lseek(this->fd, (off_t) signature_length, SEEK_SET)) {
+    if (((off_t) -1) == lseek(this->fd, (off_t) 0, SEEK_SET)) {
         error_set(error, WARN, "lseek() failed: %s", strerror(errno));
         return FALSE;
     }
+    /* decoder has to restart from the beginning of the stream */
+    DRNS(lzma_end)(&this->strm);
+    this->strm = null_strm;
+    if (LZMA_OK != (r = lzma_decoder_init(&this->strm))) {
+        error_set(error, WARN, "lzma internal error from lzma_stream_decoder(): %s", lzma_strerror(r));
+        return FALSE;
+    }
     this->eof = FALSE;
+    if (signature_length > 0) {
+        return signature_length == lzma_readBytes(fp, error, sig, MIN(signature_length, SIG_MAX_LEN));
+    }
 
     return TRUE;
 }
-#endif /* !NO_PHYSICAL_REWIND */
 
 static int32_t lzma_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
 {
     LZMA *this;
     lzma_ret r;
-    int32_t ret;
+    ssize_t ret;
     lzma_action action;
-    uint8_t in_buf[CHAR_BUFFER_SIZE];
 
     action = LZMA_RUN;
     this = (LZMA *) fp;
-    if (this->eof) {
-        return 0;
-    }
     this->strm.next_out = (uint8_t *) buffer;
     this->strm.avail_out = max_len;
-    this->strm.next_in = in_buf;
-    if (0 == (ret = read(this->fd, in_buf, ARRAY_SIZE(in_buf)))) {
-        action = LZMA_FINISH;
-    } else if (ret < 0) {
-        error_set(error, WARN, "lzma internal error from read()", strerror(errno));
-        return -1;
-    }
-    this->strm.avail_in = ret;
-    switch (r = DRNS(lzma_code)(&this->strm, action)) {
-        case LZMA_STREAM_END:
-            this->eof = TRUE;
-            break;
-        case LZMA_OK:
-            break;
-        default:
-            error_set(error, WARN, "lzma internal error from lzma_code(): %s", lzma_strerror(r));
-            return -1;
+    /**
+     * Input not consumed by the previous call (output buffer was full) is
+     * kept in this->in_buf, new data is only read once it is exhausted.
+     **/
+    while (!this->eof && this->strm.avail_out == max_len) {
+        if (0 == this->strm.avail_in) {
+            if (0 == (ret = read(this->fd, this->in_buf, ARRAY_SIZE(this->in_buf)))) {
+                action = LZMA_FINISH;
+            } else if (ret < 0) {
+                error_set(error, WARN, "lzma internal error from read(): %s", strerror(errno));
+                return -1;
+            }
+            this->strm.next_in = this->in_buf;
+            this->strm.avail_in = ret;
+        }
+        switch (r = DRNS(lzma_code)(&this->strm, action)) {
+            case LZMA_STREAM_END:
+                this->eof = TRUE;
+                break;
+            case LZMA_OK:
+                break;
+            default:
+                error_set(error, WARN, "lzma internal error from lzma_code(): %s", lzma_strerror(r));
+                return -1;
+        }
     }
 //     debug("asked = %d, get = %d", max_len, max_len - this->strm.avail_out);
 
@@ -167,9 +237,7 @@ reader_imp_t lzma_reader_imp =
 {
     FALSE,
     "lzma",
-#if 0
     "\xFD\x37\x7A\x58\x5A\x00",
-#endif
 #ifdef DYNAMIC_READERS
     lzma_trydload,
 #endif /* DYNAMIC_READERS */
@@ -177,7 +245,6 @@ reader_imp_t lzma_reader_imp =
     lzma_close,
     lzma_eof,
     lzma_readBytes
-#ifndef NO_PHYSICAL_REWIND
     , lzma_rewindTo
-#endif /* !NO_PHYSICAL_REWIND */
+    , NULL
 };
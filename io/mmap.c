@@ -12,16 +12,109 @@
 
 #include "common.h"
 
+/**
+ * The file is mapped by windows of MMAP_WINDOW_SIZE bytes: the next one
+ * is mapped (and the previous one unmapped) when the current one is
+ * consumed, so memory usage does not depend on the size of the file.
+ * Bytes given by mmap_mapBytes are valid until the next call.
+ *
+ * MMAP_WINDOW_SIZE has to be a multiple of the page size (and of the
+ * allocation granularity - 64 KiB - on Windows).
+ *
+ * Depending on --advice, the kernel is told that the file is read
+ * sequentially, that a window will be needed as soon as it is mapped
+ * and that pages behind the scan position (by steps of MMAP_DONTNEED_STEP)
+ * will not be needed anymore.
+ **/
+#ifdef DEBUG
+# define MMAP_WINDOW_SIZE (64 * 1024)
+#else
+# define MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+#endif /* DEBUG */
+#define MMAP_DONTNEED_STEP (MMAP_WINDOW_SIZE / 16)
+
 typedef struct {
 #ifdef _MSC_VER
     HANDLE fd;
 #else
     int fd;
 #endif /* _MSC_VER */
-    size_t len;
+    off_t len;     /* size of the file */
+    off_t offset;  /* position of the window in the file */
+    int advice;
     const char *start, *end, *ptr;
+    const char *released; /* [start;released[ was given back with MADV_DONTNEED */
 } MMAP;
 
+static void mmap_unmap(MMAP *this)
+{
+    if (NULL != this->start) {
+#ifdef _MSC_VER
+        UnmapViewOfFile(this->start);
+#else
+        munmap((void *) this->start, this->end - this->start);
+#endif /* _MSC_VER */
+    }
+    this->released = this->ptr = this->end = this->start = NULL;
+}
+
+/**
+ * Map the window which starts at offset (a multiple of MMAP_WINDOW_SIZE)
+ **/
+static UBool mmap_map(MMAP *this, error_t **error, off_t offset)
+{
+    size_t size;
+
+    mmap_unmap(this);
+    this->offset = offset;
+    if (offset >= this->len) {
+        return TRUE;
+    }
+    size = (size_t) MIN(this->len - offset, (off_t) MMAP_WINDOW_SIZE);
+#ifdef _MSC_VER
+    if (NULL == (this->start = MapViewOfFile(this->fd, FILE_MAP_READ, (DWORD) ((uint64_t) offset >> 32), (DWORD) offset, size))) {
+        error_win32_set(error, WARN, "MapViewOfFile failed: ");
+        return FALSE;
+    }
+#else
+    this->start = mmap(NULL, size, PROT_READ, MAP_PRIVATE, this->fd, offset);
+    if (MAP_FAILED == this->start) {
+        this->start = NULL;
+        error_set(error, WARN, "mmap failed: %s", strerror(errno));
+        return FALSE;
+    }
+#endif /* _MSC_VER */
+    this->released = this->ptr = this->start;
+    this->end = this->start + size;
+#if !defined(_MSC_VER) && defined(MADV_SEQUENTIAL)
+    if (0 != (this->advice & ADVICE_SEQUENTIAL)) {
+        madvise((void *) this->start, size, MADV_SEQUENTIAL);
+    }
+    if (0 != (this->advice & ADVICE_WILLNEED)) {
+        madvise((void *) this->start, size, MADV_WILLNEED);
+    }
+#endif /* !_MSC_VER && MADV_SEQUENTIAL */
+
+    return TRUE;
+}
+
+/**
+ * Release the pages of the window consumed so far: they were given by the
+ * previous call of mmap_mapBytes, and so are not used anymore
+ **/
+static void mmap_release(MMAP *this)
+{
+#if !defined(_MSC_VER) && defined(MADV_DONTNEED)
+    if (0 != (this->advice & ADVICE_DONTNEED) && this->ptr - this->released >= MMAP_DONTNEED_STEP) {
+        const char *upto;
+
+        upto = this->start + ((this->ptr - this->start) / MMAP_DONTNEED_STEP) * MMAP_DONTNEED_STEP;
+        madvise((void *) this->released, upto - this->released, MADV_DONTNEED);
+        this->released = upto;
+    }
+#endif /* !_MSC_VER && MADV_DONTNEED */
+}
+
 static void *mmap_dopen(error_t **error, int fd, const char * const filename)
 {
     MMAP *this;
@@ -29,8 +122,9 @@ static void *mmap_dopen(error_t **error, int fd, const char * const filename)
 
     this = mem_new(*this);
 
-    this->ptr = this->start = NULL;
-    this->len = 0;
+    this->ptr = this->end = this->start = NULL;
+    this->len = this->offset = 0;
+    this->advice = env_get_advice();
 #ifdef _MSC_VER
     this->fd = NULL;
 #else
@@ -45,32 +139,25 @@ static void *mmap_dopen(error_t **error, int fd, const char * const filename)
         error_set(error, WARN, "%s is not a regular file", filename);
         goto close;
     }
-    if (0 == (this->len = (size_t) st.st_size)) {
-        this->start = NULL;
-    } else {
+    if (0 != (this->len = st.st_size)) {
 #ifdef _MSC_VER
         if (NULL == (this->fd = CreateFileMapping((HANDLE) _get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL))) {
             error_set(error, WARN, "CreateFileMapping failed on %s: ", filename);
             goto close;
         }
-        if (NULL == (this->start = MapViewOfFile(this->fd, FILE_MAP_READ, 0, 0, 0))) {
-            CloseHandle(this->fd);
-            error_win32_set(error, WARN, "MapViewOfFile failed on %s: ", filename);
-            goto close;
-        }
 #else
         this->fd = fd;
-        this->start = mmap(NULL, this->len, PROT_READ, MAP_PRIVATE, this->fd, (off_t) 0);
-        if (MAP_FAILED == this->start) {
-            error_set(error, WARN, "mmap failed on %s: %s", filename, strerror(errno));
-            goto close;
+# ifdef POSIX_FADV_SEQUENTIAL
+        if (0 != (this->advice & ADVICE_SEQUENTIAL)) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
         }
+# endif /* POSIX_FADV_SEQUENTIAL */
 #endif /* _MSC_VER */
+        if (!mmap_map(this, error, 0)) {
+            goto close;
+        }
     }
 
-    this->ptr = this->start;
-    this->end = this->start + this->len;
-
     return this;
 
 close:
@@ -89,61 +176,88 @@ static void mmap_close(void *fp)
     MMAP *this;
 
     this = (MMAP *) fp;
+    mmap_unmap(this);
 #ifdef _MSC_VER
-    UnmapViewOfFile(this->start);
     CloseHandle(this->fd);
 #else
-    munmap((void *) this->start, this->len);
     close(this->fd);
 #endif /* _MSC_VER */
     free(this);
 }
 
-// copy of string_eof
 static UBool mmap_eof(void *fp)
 {
     MMAP *this;
 
     this = (MMAP *) fp;
 
-    return this->ptr >= this->end;
+    return this->offset + (this->ptr - this->start) >= this->len;
 }
 
-// copy of string_rewindTo
-#ifndef NO_PHYSICAL_REWIND
-static UBool mmap_rewindTo(void *fp, error_t **UNUSED(error), int32_t signature_length)
+static UBool mmap_rewindTo(void *fp, error_t **error, int32_t signature_length)
 {
     MMAP *this;
 
     this = (MMAP *) fp;
-    this->ptr = this->start + signature_length;
+    if (0 != this->offset || NULL == this->start) {
+        if (!mmap_map(this, error, 0)) {
+            return FALSE;
+        }
+    }
+    if (NULL != this->start) {
+        this->ptr = this->start + signature_length;
+    }
 
     return TRUE;
 }
-#endif /* !NO_PHYSICAL_REWIND */
 
-// copy of string_readBytes
-static int32_t mmap_readBytes(void *fp, error_t **UNUSED(error), char *buffer, size_t max_len)
+static int32_t mmap_mapBytes(void *fp, error_t **error, const char **bytes, size_t max_len)
 {
     int n;
     MMAP *this;
 
     this = (MMAP *) fp;
+    mmap_release(this);
+    if (this->ptr >= this->end && NULL != this->start) {
+        /* current window is consumed: slide to the next one */
+        if (!mmap_map(this, error, this->offset + (this->end - this->start))) {
+            return -1;
+        }
+    }
     if ((size_t) (this->end - this->ptr) > max_len) {
         n = max_len;
     } else {
         n = this->end - this->ptr;
     }
-    memcpy(buffer, this->ptr, n);
+    *bytes = this->ptr;
     this->ptr += n;
 
     return n;
 }
 
+static int32_t mmap_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    int n, total;
+    const char *bytes;
+
+    for (total = 0; (size_t) total < max_len; total += n) {
+        if (-1 == (n = mmap_mapBytes(fp, error, &bytes, max_len - total))) {
+            return -1;
+        }
+        if (0 == n) {
+            break;
+        }
+        memcpy(buffer + total, bytes, n);
+    }
+
+    return total;
+}
+
 reader_imp_t mmap_reader_imp =
 {
     FALSE,
     "mmap",
+    NULL,
 #ifdef DYNAMIC_READERS
     NULL,
 #endif /* DYNAMIC_READERS */
@@ -151,7 +265,6 @@ reader_imp_t mmap_reader_imp =
     mmap_close,
     mmap_eof,
     mmap_readBytes
-#ifndef NO_PHYSICAL_REWIND
     , mmap_rewindTo
-#endif /* !NO_PHYSICAL_REWIND */
+    , mmap_mapBytes
 };
@@ -0,0 +1,129 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE /* F_SETPIPE_SZ */
+#endif /* !_GNU_SOURCE */
+/* with _GNU_SOURCE, glibc's <errno.h> has its own error_t */
+#define error_t gnu_error_t
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#undef error_t
+
+#include "common.h"
+
+/**
+ * Reader for pipes, FIFOs and terminals: read(2) goes straight into the
+ * buffer of the reader instead of through the one of a stdio FILE, and
+ * returns what is available (a line typed on a terminal, what the writer
+ * of a pipe has produced so far) instead of waiting for the buffer to be
+ * full.
+ *
+ * The capacity of a pipe is raised (F_SETPIPE_SZ, Linux) up to PIPE_SIZE
+ * so the writer can get further ahead and each read gets a larger chunk.
+ **/
+
+#define PIPE_SIZE (1024 * 1024)
+
+typedef struct {
+    int fd;
+    UBool eof;
+} PIPE;
+
+/**
+ * Raise the capacity of the pipe, as much as allowed (an unprivileged
+ * process can't exceed /proc/sys/fs/pipe-max-size)
+ **/
+static void pipe_grow(int fd)
+{
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    int size, current;
+
+    if (-1 == (current = fcntl(fd, F_GETPIPE_SZ))) {
+        return;
+    }
+    for (size = PIPE_SIZE; size > current; size /= 2) {
+        if (-1 != fcntl(fd, F_SETPIPE_SZ, size)) {
+            debug("pipe capacity raised from %d to %d", current, size);
+            break;
+        }
+    }
+#endif /* F_SETPIPE_SZ && F_GETPIPE_SZ */
+}
+
+static void *pipe_dopen(error_t **UNUSED(error), int fd, const char * const UNUSED(filename))
+{
+    PIPE *this;
+    struct stat st;
+
+    this = mem_new(*this);
+    this->fd = fd;
+    this->eof = FALSE;
+    if (-1 != fstat(fd, &st) && S_ISFIFO(st.st_mode)) {
+        pipe_grow(fd);
+    }
+
+    return this;
+}
+
+static void pipe_close(void *fp)
+{
+    free(fp);
+}
+
+static UBool pipe_eof(void *fp)
+{
+    return ((PIPE *) fp)->eof;
+}
+
+static UBool pipe_rewindTo(void *fp, error_t **error, int32_t signature_length)
+{
+    PIPE *this;
+
+    this = (PIPE *) fp;
+    if (-1 == lseek(this->fd, (off_t) signature_length, SEEK_SET)) {
+        error_set(error, WARN, "lseek failed: %s", strerror(errno));
+        return FALSE;
+    }
+    this->eof = FALSE;
+
+    return TRUE;
+}
+
+static int32_t pipe_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    ssize_t ret;
+    PIPE *this;
+
+    this = (PIPE *) fp;
+    if (this->eof) {
+        return 0;
+    }
+    while (-1 == (ret = read(this->fd, buffer, max_len))) {
+        if (EINTR != errno) {
+            error_set(error, WARN, "read failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    if (0 == ret) {
+        this->eof = TRUE;
+    }
+
+    return ret;
+}
+
+reader_imp_t pipe_reader_imp =
+{
+    FALSE,
+    "pipe",
+    NULL,
+#ifdef DYNAMIC_READERS
+    NULL,
+#endif /* DYNAMIC_READERS */
+    pipe_dopen,
+    pipe_close,
+    pipe_eof,
+    pipe_readBytes
+    , pipe_rewindTo
+    , NULL
+};
@@ -1,5 +1,8 @@
 #include <unistd.h>
 #include <sys/types.h>
+#ifndef _MSC_VER
+# include <sys/mman.h>
+#endif /* !_MSC_VER */
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -11,9 +14,14 @@
 
 /* ==================== global ==================== */
 
+extern reader_imp_t archive_reader_imp;
 extern reader_imp_t mmap_reader_imp;
+extern reader_imp_t pipe_reader_imp;
 extern reader_imp_t stdio_reader_imp;
 extern reader_imp_t string_reader_imp;
+#ifdef HAVE_LINUX_IO_URING_H
+extern reader_imp_t uring_reader_imp;
+#endif /* HAVE_LINUX_IO_URING_H */
 #if defined(HAVE_ZLIB) || defined(DYNAMIC_READERS)
 extern reader_imp_t zlib_reader_imp;
 #endif /* HAVE_ZLIB || DYNAMIC_READERS */
@@ -23,10 +31,17 @@ extern reader_imp_t bzip2_reader_imp;
 #if defined(HAVE_LZMA) || defined(DYNAMIC_READERS)
 extern reader_imp_t lzma_reader_imp;
 #endif /* HAVE_LZMA || DYNAMIC_READERS */
+#ifdef HAVE_ZSTD
+extern reader_imp_t zstd_reader_imp;
+#endif /* HAVE_ZSTD */
 
 static const reader_imp_t *available_readers[] = {
     &mmap_reader_imp,
+    &pipe_reader_imp,
     &stdio_reader_imp,
+#ifdef HAVE_LINUX_IO_URING_H
+    &uring_reader_imp,
+#endif /* HAVE_LINUX_IO_URING_H */
 #if defined(HAVE_ZLIB) || defined(DYNAMIC_READERS)
     &zlib_reader_imp,
 #endif /* HAVE_ZLIB || DYNAMIC_READERS */
@@ -36,59 +51,275 @@ static const reader_imp_t *available_readers[] = {
 #if defined(HAVE_LZMA) || defined(DYNAMIC_READERS)
     &lzma_reader_imp,
 #endif /* HAVE_LZMA || DYNAMIC_READERS */
+#ifdef HAVE_ZSTD
+    &zstd_reader_imp,
+#endif /* HAVE_ZSTD */
     NULL
 };
 
 void *string_open(const char *buffer, int length);
+void *archive_open(error_t **, const reader_imp_t *, void *, const char *);
+const char *archive_next(void *, error_t **);
+void archive_close(void *);
+UBool utf8_to_utf16(UChar **, const UChar *, const char **, const char *, UBool);
+UBool utf16_to_utf16(UChar **, const UChar *, const char **, const char *, UBool);
+UBool utf8_is_valid(const char *, const char *, UBool *);
+const UChar *utf16_find_eol(const UChar *, const UChar *);
+const char *utf8_find_eol(const char *, const char *);
 
 /* ==================== private helpers for reading ==================== */
 
-static int32_t fill_buffer(reader_t *this, error_t **error)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * (Re)allocate a buffer of size bytes, keeping its old_size first bytes.
+ * With --advice=hugepage, buffers of at least HUGE_PAGE_SIZE bytes are
+ * aligned on it and backed by transparent huge pages.
+ **/
+static void *buffer_renew(void *ptr, size_t old_size, size_t size)
 {
-    size_t utf16diff, bytesdiff;
-    UChar *utf16Ptr;
+#ifdef MADV_HUGEPAGE
+    if (0 != (env_get_advice() & ADVICE_HUGEPAGE) && size >= HUGE_PAGE_SIZE) {
+        void *nptr;
+
+        ensure(0 == posix_memalign(&nptr, HUGE_PAGE_SIZE, size));
+        madvise(nptr, size - size % HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+        if (NULL != ptr) {
+            memcpy(nptr, ptr, MIN(old_size, size));
+            free(ptr);
+        }
+
+        return nptr;
+    }
+#endif /* MADV_HUGEPAGE */
+
+    return _mem_realloc(ptr, size);
+}
+
+static void grow_buffers(reader_t *this)
+{
+    size_t size;
+    char *oldbytes;
+    UChar *oldutf16;
+
+    oldbytes = this->byte.buffer;
+    size = 2 * (this->byte.limit - this->byte.buffer);
+    this->byte.buffer = buffer_renew(this->byte.buffer, this->byte.limit - this->byte.buffer, size);
+    this->byte.ptr = this->byte.buffer + (this->byte.ptr - oldbytes);
+    this->byte.end = this->byte.buffer + (this->byte.end - oldbytes);
+    this->byte.limit = this->byte.buffer + size;
+
+    oldutf16 = this->utf16.buffer;
+    size = 2 * (this->utf16.limit - this->utf16.buffer);
+    this->utf16.buffer = buffer_renew(this->utf16.buffer, (this->utf16.limit - this->utf16.buffer) * sizeof(*this->utf16.buffer), size * sizeof(*this->utf16.buffer));
+    this->utf16.ptr = this->utf16.buffer + (this->utf16.ptr - oldutf16);
+    this->utf16.end = this->utf16.buffer + (this->utf16.end - oldutf16);
+    this->utf16.tail = this->utf16.buffer + (this->utf16.tail - oldutf16);
+    this->utf16.limit = this->utf16.buffer + size;
+}
+
+static int32_t max_bytes_to_read(reader_t *this)
+{
+    int32_t bytesAvailable, utf16Available;
+
+    bytesAvailable = this->byte.limit - this->byte.end;
+    utf16Available = this->utf16.limit - this->utf16.tail;
+
+    return MIN(bytesAvailable, utf16Available) / (2 * ucnv_getMinCharSize(this->ucnv));
+}
+
+/**
+ * Use the built-in decoder when input is UTF-8, US-ASCII or UTF-16 with a
+ * known byte order, ICU otherwise
+ **/
+static void select_decoder(reader_t *this)
+{
+    const char *name;
     UErrorCode status;
-    int32_t bytesAvailable, bytesRead, utf16Length, maxBytesToRead;
 
-    utf16Length = 0;
     status = U_ZERO_ERROR;
-    utf16diff = this->utf16.ptr - this->utf16.buffer;
-    if (utf16diff > 0) {
-        u_memmove(this->utf16.buffer, this->utf16.ptr, this->utf16.end - this->utf16.ptr);
-        this->utf16.end -= utf16diff;
-        this->utf16.ptr = this->utf16.buffer;
-    }
-    bytesdiff = this->byte.ptr - this->byte.buffer;
-    if (bytesdiff > 0 && this->byte.end > this->byte.ptr) {
-        memmove(this->byte.buffer, this->byte.ptr, this->byte.end - this->byte.ptr);
-        this->byte.end -= bytesdiff;
-        this->byte.ptr = this->byte.buffer;
+    name = ucnv_getName(this->ucnv, &status);
+    if (U_FAILURE(status)) {
+        this->decoder = DECODER_ICU;
+    } else if (!strcmp("UTF-8", name)) {
+        this->decoder = DECODER_UTF8;
+    } else if (!strcmp("US-ASCII", name)) {
+        this->decoder = DECODER_ASCII;
+    } else if (!strcmp(U_IS_BIG_ENDIAN ? "UTF-16BE" : "UTF-16LE", name)) {
+        this->decoder = DECODER_UTF16;
+    } else if (!strcmp(U_IS_BIG_ENDIAN ? "UTF-16LE" : "UTF-16BE", name)) {
+        this->decoder = DECODER_UTF16_SWAPPED;
     } else {
-        this->byte.end = this->byte.ptr = this->byte.buffer;
+        this->decoder = DECODER_ICU;
     }
-    bytesAvailable = this->byte.limit - this->byte.end;
-    maxBytesToRead = MIN(bytesAvailable / (2 * ucnv_getMinCharSize(this->ucnv)), CHAR_BUFFER_SIZE);
-    if (-1 == (bytesRead = this->imp->readBytes(this->fp, error, this->byte.ptr, maxBytesToRead))) {
-        return -1;
+}
+
+/**
+ * Convert [*source;sourceLimit[ into UTF-16 from *target (up to this->utf16.limit)
+ * Bytes which are not consumed (for built-in decoder) are a truncated sequence
+ **/
+static UBool decode(reader_t *this, error_t **error, UChar **target, const char **source, const char *sourceLimit, UBool flush)
+{
+    UErrorCode status;
+
+    if (DECODER_ICU != this->decoder) {
+        UBool valid;
+
+        if (DECODER_UTF16 == this->decoder || DECODER_UTF16_SWAPPED == this->decoder) {
+            valid = utf16_to_utf16(target, this->utf16.limit, source, sourceLimit, DECODER_UTF16_SWAPPED == this->decoder);
+        } else {
+            valid = utf8_to_utf16(target, this->utf16.limit, source, sourceLimit, DECODER_ASCII == this->decoder);
+        }
+        if (!valid) {
+            /* invalid sequence: ICU takes over until the end of input for consistent substitutions */
+            this->decoder = DECODER_ICU;
+        } else if (!flush || *source == sourceLimit) {
+            return TRUE;
+        }
     }
-    this->byte.end = this->byte.ptr + bytesRead;
-    utf16Ptr = this->utf16.ptr;
-    ucnv_toUnicode(
-        this->ucnv,
-        &utf16Ptr, this->utf16.limit,
-        (const char **) &this->byte.ptr, this->byte.end,
-        NULL,
-        this->imp->eof(this->fp),
-        &status
-    );
+    status = U_ZERO_ERROR;
+    ucnv_toUnicode(this->ucnv, target, this->utf16.limit, source, sourceLimit, NULL, flush, &status);
     if (U_FAILURE(status)) {
         icu_error_set(error, FATAL, status, "ucnv_toUnicode");
-        return -1;
+        return FALSE;
     }
-    utf16Length = utf16Ptr - this->utf16.ptr;
-    this->utf16.end = utf16Ptr;
 
-    return utf16Length;
+    return TRUE;
+}
+
+/**
+ * Normalize what was just decoded ([utf16.end;utf16.tail[) in place, up to
+ * its last normalization boundary (what follows may combine with the next
+ * characters) or entirely on flush, and move utf16.end accordingly.
+ * Text which passes the quick check (most of it) is left as is.
+ **/
+static UBool normalize_buffer(reader_t *this, error_t **error, UBool flush)
+{
+    UChar32 c;
+    UChar *dest;
+    UErrorCode status;
+    int32_t i, span, length, tail_length, result_length;
+
+    if (NULL == this->normalization.instance) {
+        this->utf16.end = this->utf16.tail;
+        return TRUE;
+    }
+    length = this->utf16.tail - this->utf16.end;
+    if (!flush) {
+        for (i = length; i > 0; ) {
+            U16_PREV(this->utf16.end, 0, i, c);
+            if (unorm2_hasBoundaryBefore(this->normalization.instance, c)) {
+                break;
+            }
+        }
+        length = i;
+    }
+    status = U_ZERO_ERROR;
+    span = unorm2_spanQuickCheckYes(this->normalization.instance, this->utf16.end, length, &status);
+    if (U_FAILURE(status)) {
+        icu_error_set(error, FATAL, status, "unorm2_spanQuickCheckYes");
+        return FALSE;
+    }
+    if (span < length) {
+        /* normalize a copy back into the buffer, the held back part is put after it */
+        tail_length = this->utf16.tail - this->utf16.end - length;
+        if (this->normalization.size < (size_t) (length - span + tail_length)) {
+            this->normalization.size = length - span + tail_length;
+            this->normalization.buffer = mem_renew(this->normalization.buffer, *this->normalization.buffer, this->normalization.size);
+        }
+        u_memcpy(this->normalization.buffer, this->utf16.end + span, length - span + tail_length);
+        do {
+            status = U_ZERO_ERROR;
+            dest = this->utf16.end + span;
+            result_length = unorm2_normalize(this->normalization.instance, this->normalization.buffer, length - span, dest, this->utf16.limit - dest - tail_length, &status);
+            if (U_BUFFER_OVERFLOW_ERROR == status) {
+                grow_buffers(this);
+            }
+        } while (U_BUFFER_OVERFLOW_ERROR == status);
+        if (U_FAILURE(status)) {
+            icu_error_set(error, FATAL, status, "unorm2_normalize");
+            return FALSE;
+        }
+        u_memcpy(dest + result_length, this->normalization.buffer + length - span, tail_length);
+        this->utf16.end = dest + result_length;
+        this->utf16.tail = this->utf16.end + tail_length;
+    } else {
+        this->utf16.end += length;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Return:
+ * - -1 on error
+ * - else, the number of UChar available from this->utf16.ptr
+ **/
+static int32_t fill_buffer(reader_t *this, error_t **error)
+{
+    size_t utf16diff, bytesdiff;
+    UChar *utf16Ptr, *utf16End;
+    int32_t bytesRead, maxBytesToRead, converted;
+
+    utf16diff = this->utf16.ptr - this->utf16.buffer;
+    if (utf16diff > 0) {
+        u_memmove(this->utf16.buffer, this->utf16.ptr, this->utf16.tail - this->utf16.ptr);
+        this->utf16.end -= utf16diff;
+        this->utf16.tail -= utf16diff;
+        this->utf16.ptr = this->utf16.buffer;
+    }
+    /* what is pending (a long line) takes more than half of the buffer: double it instead of reading by small chunks */
+    if (2 * (this->utf16.tail - this->utf16.buffer) > this->utf16.limit - this->utf16.buffer) {
+        grow_buffers(this);
+    }
+    /* bytes read may not be enough to make a single UChar (eg UTF-32): read again to not be mistaken for EOF */
+    do {
+        bytesdiff = this->byte.ptr - this->byte.buffer;
+        if (this->byte.end <= this->byte.ptr) {
+            this->byte.end = this->byte.ptr = this->byte.buffer;
+        } else if (bytesdiff > 0) {
+            memmove(this->byte.buffer, this->byte.ptr, this->byte.end - this->byte.ptr);
+            this->byte.end -= bytesdiff;
+            this->byte.ptr = this->byte.buffer;
+        }
+        while (0 == (maxBytesToRead = max_bytes_to_read(this))) {
+            grow_buffers(this);
+        }
+        utf16Ptr = this->utf16.tail;
+        if (NULL != this->imp->mapBytes && this->byte.ptr == this->byte.end) {
+            /* nothing pending: the converter reads straight from the implementation (mmap), no intermediate copy */
+            const char *mapped, *mappedEnd;
+
+            if (-1 == (bytesRead = this->imp->mapBytes(this->fp, error, &mapped, maxBytesToRead))) {
+                return -1;
+            }
+            mappedEnd = mapped + bytesRead;
+            if (!decode(this, error, &utf16Ptr, &mapped, mappedEnd, this->imp->eof(this->fp))) {
+                return -1;
+            }
+            if (mapped < mappedEnd) {
+                /* truncated sequence left by the built-in decoder: keep it for the next round */
+                memcpy(this->byte.end, mapped, mappedEnd - mapped);
+                this->byte.end += mappedEnd - mapped;
+            }
+        } else {
+            if (-1 == (bytesRead = this->imp->readBytes(this->fp, error, this->byte.end, maxBytesToRead))) {
+                return -1;
+            }
+            this->byte.end += bytesRead;
+            if (!decode(this, error, &utf16Ptr, (const char **) &this->byte.ptr, this->byte.end, this->imp->eof(this->fp))) {
+                return -1;
+            }
+        }
+        this->utf16.tail = utf16Ptr;
+        utf16End = this->utf16.end;
+        if (!normalize_buffer(this, error, this->imp->eof(this->fp))) {
+            return -1;
+        }
+        converted = this->utf16.end - utf16End;
+    } while (0 == converted && bytesRead > 0 && !this->imp->eof(this->fp));
+
+    return this->utf16.end - this->utf16.ptr;
 }
 
 /* ==================== public functions for reading ==================== */
@@ -128,16 +359,16 @@ UBool reader_readline(reader_t *this, error_t **error, UString *ustr) /* NONNULL
     }
     while (available > 0) {
         p = this->utf16.ptr;
-        while (p < this->utf16.end) {
+        while ((p = (UChar *) utf16_find_eol(p, this->utf16.end)) < this->utf16.end) {
             switch (*p) {
                 case U_CR:
                     if ((p + 1) >= this->utf16.end) {
                         copy_full_buffer_into_ustring(this, ustr);
-                        if (-1 == fill_buffer(this, error)) {
+                        if (-1 == (available = fill_buffer(this, error))) {
                             return FALSE;
                         }
                         p = this->utf16.ptr;
-                        if (U_LF == *p) {
+                        if (available > 0 && U_LF == *p) {
                             ustring_append_char(ustr, *p);
                             ++this->utf16.ptr;
                         }
@@ -168,11 +399,104 @@ eol:
         available = 1;
     }
     ++this->lineno;
-    ustring_normalize(ustr, env_get_normalization());
 
     return available > 0;
 }
 
+/**
+ * Zero-copy equivalent of reader_readline: view is set to the line, without
+ * its end of line, in the internal buffer of the reader. It is read only
+ * (it must not be grown or destroyed) and valid until the next read.
+ * Lines are NUL terminated as a UString.
+ *
+ * Return:
+ * - TRUE: a line was read
+ * - FALSE: no more line (error or EOF - check error == NULL if passed)
+ **/
+UBool reader_readline_view(reader_t *this, error_t **error, UString *view) /* NONNULL(1, 3) */
+{
+    UChar *p;
+    UBool last;
+    size_t offset;
+    int32_t eol, pending, available;
+
+    require_else_return_false(NULL != this);
+    require_else_return_false(NULL != view);
+
+    if (NULL != this->window.hole) {
+        *this->window.hole = this->window.saved;
+        this->window.hole = NULL;
+    }
+    last = FALSE;
+    offset = 0;
+    while (TRUE) {
+        p = (UChar *) utf16_find_eol(this->utf16.ptr + offset, this->utf16.end);
+        if (this->window.size > 0 && p - this->utf16.ptr > this->window.size) {
+            /**
+             * The line is too long to be held as a whole: return a window of it instead.
+             * Consecutive windows overlap on 2 margins, the next one starting at
+             * window.size - 2 * window.margin so that its first margin, ahead of
+             * what it brings, is the context which precedes it. The view can't be
+             * terminated by overwriting its EOL: its last UChar is saved in the mean time.
+             **/
+            view->len = this->window.size;
+            if (U16_IS_LEAD(this->utf16.ptr[view->len - 1])) {
+                --view->len;
+            }
+            view->ptr = this->utf16.ptr;
+            view->allocated = view->len;
+            this->window.hole = this->utf16.ptr + view->len;
+            this->window.saved = *this->window.hole;
+            *this->window.hole = 0;
+            this->utf16.ptr += view->len - 2 * this->window.margin;
+            if (!this->window.partial) {
+                ++this->lineno;
+            }
+            this->window.continued = this->window.partial;
+            this->window.partial = TRUE;
+
+            return TRUE;
+        }
+        if (p < this->utf16.end) {
+            /* a CR at the end of the buffer may be followed by a LF */
+            if (U_CR != *p || p + 1 < this->utf16.end || last) {
+                eol = (U_CR == *p && p + 1 < this->utf16.end && U_LF == p[1]) ? 2 : 1;
+                break;
+            }
+        } else if (last) {
+            if (this->utf16.ptr == this->utf16.end) {
+                return FALSE;
+            }
+            /* last line, without end of line */
+            if (this->utf16.end == this->utf16.limit) {
+                offset = p - this->utf16.ptr;
+                grow_buffers(this);
+                p = this->utf16.ptr + offset;
+            }
+            eol = 0;
+            break;
+        }
+        /* the line straddles a refill: fill_buffer moves it to the beginning of the buffer, continue from there */
+        offset = p - this->utf16.ptr;
+        pending = this->utf16.end - this->utf16.ptr;
+        if (-1 == (available = fill_buffer(this, error))) {
+            return FALSE;
+        }
+        last = available == pending;
+    }
+    view->ptr = this->utf16.ptr;
+    view->allocated = view->len = p - this->utf16.ptr;
+    this->utf16.ptr = p + eol;
+    *p = 0;
+    if (!this->window.partial) {
+        ++this->lineno;
+    }
+    this->window.continued = this->window.partial;
+    this->window.partial = FALSE;
+
+    return TRUE;
+}
+
 UChar32 reader_readuchar32(reader_t *this, error_t **error) /* NONNULL(1) */
 {
     require_else_return_val(NULL != this, -1);
@@ -207,29 +531,17 @@ int32_t reader_readuchars32(reader_t *this, error_t **error, UChar32 *buffer, in
     require_else_return_val(NULL != buffer, -1);
     require_else_return_val(maxLen >= 1, -1);
 
-#if NO_PHYSICAL_REWIND
-    available = this->utf16.end - this->utf16.ptr;
-    if (0 == available) {
-        if ((available = fill_buffer(this, error)) < 1) {
-            return -1;
-        }
-    }
-#endif /* NO_PHYSICAL_REWIND */
     for (i = 0; i < maxLen; i++) {
         if ((this->utf16.end - this->utf16.ptr) < 2) {
-#ifndef NO_PHYSICAL_REWIND
             if ((available = fill_buffer(this, error)) < 1) {
                 if (-1 == available) {
                     i = -1;
                 }
                 break;
             }
-#else
-            break;
-#endif /* !NO_PHYSICAL_REWIND */
         }
         buffer[i] = *this->utf16.ptr++;
-        if (U_IS_LEAD(buffer[i])) {
+        if (U_IS_LEAD(buffer[i]) && this->utf16.ptr < this->utf16.end) {
             buffer[i] = U16_GET_SUPPLEMENTARY(buffer[i], *this->utf16.ptr);
             ++this->utf16.ptr;
         }
@@ -275,6 +587,323 @@ int32_t reader_readuchars(reader_t *this, error_t **error, UChar *buffer, int32_
     return count;
 }
 
+/* ==================== public functions for reading raw (UTF-8) lines ==================== */
+
+/**
+ * UTF-8 inputs can be read line by line without being decoded: lines
+ * are delimited on their bytes and only decoded on demand. Only lines
+ * which are to be printed (ugrep) have to pay for the conversion.
+ **/
+
+#define RAW_MAP_MAX_LEN INT32_MAX
+
+/**
+ * Return:
+ * - the length of the end of line starting at s
+ * - 0 if s doesn't start an end of line
+ * - -1 if more bytes are needed to tell
+ **/
+static int raw_eol_length(const uint8_t *s, const uint8_t *end, UBool eof)
+{
+    switch (*s) {
+        case 0x0A:
+        case 0x0B:
+        case 0x0C:
+            return 1;
+        case 0x0D:
+            if (end - s < 2) {
+                return eof ? 1 : -1;
+            }
+            return 0x0A == s[1] ? 2 : 1;
+        case 0xC2:
+            if (end - s < 2) {
+                return eof ? 0 : -1;
+            }
+            return 0x85 == s[1] ? 2 : 0;
+        case 0xE2:
+            if (end - s < 2 || (end - s < 3 && 0x80 == s[1])) {
+                return eof ? 0 : -1;
+            }
+            return (0x80 == s[1] && (0xA8 == s[2] || 0xA9 == s[2])) ? 3 : 0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Get more bytes after the pending ones ([this->raw.ptr;this->raw.end[)
+ * Return the number of bytes read, -1 on error
+ **/
+static int32_t fill_raw(reader_t *this, error_t **error)
+{
+    int32_t pending, bytesRead;
+
+    pending = this->raw.end - this->raw.ptr;
+    if (0 == pending && NULL != this->imp->mapBytes) {
+        /* nothing pending: lines are read in place (mmap) */
+        const char *mapped;
+
+        if (-1 == (bytesRead = this->imp->mapBytes(this->fp, error, &mapped, RAW_MAP_MAX_LEN))) {
+            return -1;
+        }
+        this->raw.ptr = mapped;
+        this->raw.end = mapped + bytesRead;
+    } else {
+        /**
+         * the pending (long) line fills the whole buffer (it then starts at its
+         * beginning) or, for mapped bytes, even exceeds it: double it
+         **/
+        if (pending >= this->byte.limit - this->byte.buffer) {
+            size_t size;
+            UBool inside;
+
+            inside = this->raw.ptr == this->byte.buffer;
+            size = this->byte.limit - this->byte.buffer;
+            do {
+                size *= 2;
+            } while ((size_t) pending >= size);
+            this->byte.buffer = buffer_renew(this->byte.buffer, this->byte.limit - this->byte.buffer, size);
+            this->byte.limit = this->byte.buffer + size;
+            if (inside) {
+                this->raw.ptr = this->byte.buffer;
+            }
+        }
+        if (pending > 0 && this->raw.ptr != this->byte.buffer) {
+            memmove(this->byte.buffer, this->raw.ptr, pending);
+        }
+        this->byte.ptr = this->byte.end = this->byte.buffer;
+        if (-1 == (bytesRead = this->imp->readBytes(this->fp, error, this->byte.buffer + pending, this->byte.limit - this->byte.buffer - pending))) {
+            return -1;
+        }
+        this->raw.ptr = this->byte.buffer;
+        this->raw.end = this->byte.buffer + pending + bytesRead;
+    }
+
+    return bytesRead;
+}
+
+/**
+ * Switch the reader to raw reading, just after reader_open
+ * Return FALSE if input is not (so far) a valid UTF-8 input
+ **/
+UBool reader_start_raw(reader_t *this, error_t **error) /* NONNULL(1) */
+{
+    require_else_return_false(NULL != this);
+
+    if (DECODER_UTF8 != this->decoder) {
+        return FALSE;
+    }
+    if (NULL != this->imp->mapBytes) {
+        /* start over to map the input instead of stitching the beginning kept in memory to the mapping */
+        if (!this->imp->rewindTo(this->fp, error, this->signature_length)) {
+            return FALSE;
+        }
+        this->raw.ptr = this->raw.end = this->byte.buffer;
+    } else if (this->byte.end > this->byte.buffer) {
+        /* bytes read for charset and binary detection (see reader_can_rewind_in_memory) */
+        this->raw.ptr = this->byte.buffer + this->signature_length;
+        this->raw.end = this->byte.end;
+    } else {
+        this->raw.ptr = this->raw.end = this->byte.buffer;
+    }
+    this->utf16.ptr = this->utf16.end = this->utf16.tail = this->utf16.buffer;
+
+    return TRUE;
+}
+
+/**
+ * Return the end of the longest run of lines, from p, which are already
+ * what reading them and printing them back, each followed by a LF, would
+ * give: well-formed UTF-8 without NUL, ended by a single LF.
+ * *irregular is set to TRUE if this run is followed by a line which is
+ * not (another end of line, invalid sequence, ...), FALSE if it is only
+ * followed by an incomplete line.
+ **/
+static const char *verbatim_lines_end(const char *p, const char *end, UBool *irregular)
+{
+    int eol;
+    UBool ascii;
+    const char *q, *line;
+
+    *irregular = FALSE;
+    for (line = q = p; (q = utf8_find_eol(q, end)) < end; ) {
+        if (0x0A == *q) {
+            if (!utf8_is_valid(line, q + 1, &ascii)) {
+                *irregular = TRUE;
+                break;
+            }
+            line = ++q;
+        } else if (0 == (eol = raw_eol_length((const uint8_t *) q, (const uint8_t *) end, FALSE))) {
+            ++q;
+        } else {
+            *irregular = -1 != eol;
+            break;
+        }
+    }
+
+    return line;
+}
+
+/**
+ * Copy input to fd, from the current position (just after reader_open)
+ * and without decoding it, as long as it is made of lines which would be
+ * read as they are and would be output the same, each followed by a LF,
+ * in UTF-8 (see verbatim_lines_end). This stops on the first line which
+ * is not, this one and the following ones being left to the usual
+ * functions (reader_readline, ...).
+ *
+ * This is only done for pipes and terminals (see pipe_reader_imp), when
+ * input is UTF-8 and not normalized: the bytes are read straight into
+ * the buffer of the reader then written.
+ *
+ * Return FALSE on error
+ **/
+UBool reader_copy_verbatim(reader_t *this, error_t **error, int fd) /* NONNULL(1) */
+{
+    ssize_t written;
+    UBool irregular;
+    UChar *utf16Ptr;
+    int32_t bytesRead;
+    const char *verbatimEnd;
+
+    require_else_return_false(NULL != this);
+
+    if (&pipe_reader_imp != this->imp || DECODER_UTF8 != this->decoder || NULL != this->normalization.instance || this->utf16.ptr != this->utf16.tail) {
+        return TRUE;
+    }
+    do {
+        if (this->byte.ptr > this->byte.buffer) {
+            memmove(this->byte.buffer, this->byte.ptr, this->byte.end - this->byte.ptr);
+            this->byte.end -= this->byte.ptr - this->byte.buffer;
+            this->byte.ptr = this->byte.buffer;
+        }
+        if (this->byte.end == this->byte.limit) {
+            /* a line longer than the buffer */
+            break;
+        }
+        if (-1 == (bytesRead = this->imp->readBytes(this->fp, error, this->byte.end, this->byte.limit - this->byte.end))) {
+            return FALSE;
+        }
+        this->byte.end += bytesRead;
+        verbatimEnd = verbatim_lines_end(this->byte.ptr, this->byte.end, &irregular);
+        while (this->byte.ptr < verbatimEnd) {
+            if (-1 == (written = write(fd, this->byte.ptr, verbatimEnd - this->byte.ptr))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                error_set(error, WARN, "write failed: %s", strerror(errno));
+                return FALSE;
+            }
+            this->byte.ptr += written;
+        }
+    } while (!irregular && bytesRead > 0);
+    /* decode what is left now: reader_eof only looks at the UTF-16 buffer */
+    if (this->byte.ptr < this->byte.end) {
+        utf16Ptr = this->utf16.tail;
+        if (!decode(this, error, &utf16Ptr, (const char **) &this->byte.ptr, this->byte.end, this->imp->eof(this->fp))) {
+            return FALSE;
+        }
+        this->utf16.tail = utf16Ptr;
+        if (!normalize_buffer(this, error, this->imp->eof(this->fp))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Raw equivalent of reader_readline: *line points to the bytes of the
+ * line (including its end of line), which are valid until the next call.
+ *
+ * Return:
+ * - TRUE: a line was read
+ * - FALSE: no more line (error or EOF - check error == NULL if passed)
+ **/
+UBool reader_readline_raw(reader_t *this, error_t **error, const char **line, int32_t *length) /* NONNULL(1, 3, 4) */
+{
+    int eol;
+    size_t offset;
+    int32_t bytesRead;
+    const char *p, *end;
+
+    require_else_return_false(NULL != this);
+    require_else_return_false(NULL != line);
+    require_else_return_false(NULL != length);
+
+    offset = 0;
+    while (TRUE) {
+        p = this->raw.ptr + offset;
+        end = this->raw.end;
+        while ((p = utf8_find_eol(p, end)) < end) {
+            if ((eol = raw_eol_length((const uint8_t *) p, (const uint8_t *) end, end - p < 3 && this->imp->eof(this->fp))) > 0) {
+                p += eol;
+                goto eol;
+            } else if (eol < 0) {
+                break;
+            }
+            ++p;
+        }
+        offset = p - this->raw.ptr;
+        if (this->imp->eof(this->fp) || 0 == (bytesRead = fill_raw(this, error))) {
+            /* last line, without end of line */
+            p = this->raw.end;
+            break;
+        } else if (-1 == bytesRead) {
+            return FALSE;
+        }
+    }
+    if (this->raw.ptr == this->raw.end) {
+        return FALSE;
+    }
+eol:
+    *line = this->raw.ptr;
+    *length = p - this->raw.ptr;
+    this->raw.ptr = p;
+    ++this->lineno;
+
+    return TRUE;
+}
+
+/**
+ * Decode a line got from reader_readline_raw into ustr
+ **/
+UBool reader_decode_raw(reader_t *this, error_t **error, const char *line, int32_t length, UString *ustr) /* NONNULL(1, 3, 5) */
+{
+    UBool valid;
+    UChar *target;
+    const char *end;
+    UErrorCode status;
+
+    require_else_return_false(NULL != this);
+    require_else_return_false(NULL != line);
+    require_else_return_false(NULL != ustr);
+
+    ustring_truncate(ustr);
+    end = line + length;
+    while (line < end) {
+        target = this->utf16.buffer;
+        valid = utf8_to_utf16(&target, this->utf16.limit, &line, end, FALSE);
+        ustring_append_string_len(ustr, this->utf16.buffer, target - this->utf16.buffer);
+        if (!valid || (line < end && this->utf16.limit - target > 1)) {
+            /* invalid or truncated sequence: let ICU substitute it, as for the decoded input */
+            ucnv_resetToUnicode(this->ucnv);
+            do {
+                status = U_ZERO_ERROR;
+                target = this->utf16.buffer;
+                ucnv_toUnicode(this->ucnv, &target, this->utf16.limit, &line, end, NULL, TRUE, &status);
+                ustring_append_string_len(ustr, this->utf16.buffer, target - this->utf16.buffer);
+            } while (U_BUFFER_OVERFLOW_ERROR == status);
+            if (U_FAILURE(status)) {
+                icu_error_set(error, FATAL, status, "ucnv_toUnicode");
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
 /* ==================== private misc helpers ==================== */
 
 static UBool is_binary_uchar(UChar32 c)
@@ -294,111 +923,308 @@ static UBool is_binary(UChar32 *buffer, size_t buffer_len) /* NONNULL(1) */
         }
     }
 
-    return ((size_t)(p - buffer)) < buffer_len;
+    return ((size_t)(p - buffer)) < buffer_len;
+}
+
+/**
+ * Whatever the encoding is, 4 NUL bytes aligned on 4 bytes among the first
+ * MAX_BIN_REL_LEN bytes decode to U+0000 within the first MAX_BIN_REL_LEN
+ * code points, which is enough for is_binary to consider the file as binary.
+ * This allows to recognize most binary files before charset detection.
+ **/
+static UBool has_nul_code_point(const char *buffer, size_t buffer_len) /* NONNULL() */
+{
+    size_t i;
+    uint32_t word;
+
+    if (buffer_len > MAX_BIN_REL_LEN) {
+        buffer_len = MAX_BIN_REL_LEN;
+    }
+    for (i = 0; i + sizeof(word) <= buffer_len; i += sizeof(word)) {
+        memcpy(&word, buffer + i, sizeof(word));
+        if (0 == word) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Classify as binary or text the bytes read for charset detection, without
+ * decoding them, when they are in UTF-8 or US-ASCII. It looks at the same
+ * MAX_BIN_REL_LEN first code points as is_binary, plus:
+ * - NUL bytes (not seen by ICU converters as a code point among others)
+ * - the density of invalid sequences (more than 1 in 8 code points)
+ *
+ * Return -1 if inconclusive (the decoded text is then given to is_binary)
+ **/
+static int sniff_binary(reader_t *this, const char *buffer, size_t buffer_len) /* NONNULL() */
+{
+    UChar32 c;
+    int32_t count, invalid, i, length;
+
+    if (DECODER_UTF8 != this->decoder && DECODER_ASCII != this->decoder) {
+        return -1;
+    }
+    length = buffer_len;
+    invalid = 0;
+    i = this->signature_length;
+    for (count = 0; count < MAX_BIN_REL_LEN && i < length; count++) {
+        if ((uint8_t) buffer[i] < 0x80) {
+            c = (uint8_t) buffer[i++];
+        } else if (DECODER_ASCII == this->decoder) {
+            /* ICU substitutes whatever its US-ASCII converter wants, let it tell */
+            return -1;
+        } else {
+            U8_NEXT(buffer, i, length, c);
+            if (c < 0) {
+                if (i >= length) {
+                    /* sequence truncated by the end of the buffer */
+                    break;
+                }
+                ++invalid;
+                continue;
+            }
+        }
+        if (0 == c || is_binary_uchar(c)) {
+            return TRUE;
+        }
+    }
+
+    return invalid > count / 8;
+}
+
+/**
+ * Standard input, even redirected from a file, and pipes, FIFOs, ... are not rewound
+ * (members of an archive are, whatever it is read from: see archive.c)
+ **/
+static UBool reader_is_seekable(reader_t *this)
+{
+    require_else_return_false(NULL != this);
+
+    if (&archive_reader_imp == this->imp) {
+        return TRUE;
+    }
+
+    return STDIN_FILENO != this->fd && -1 != lseek(this->fd, 0, SEEK_CUR);
+}
+
+/**
+ * Data read for charset and binary detection can be kept in memory to
+ * rewind (instead of seeking back) if buffers are large enough to hold it
+ **/
+static UBool reader_can_rewind_in_memory(reader_t *this)
+{
+    return (this->byte.limit - this->byte.buffer) > MAX_ENC_REL_LEN && (this->utf16.limit - this->utf16.buffer) > (4 * MAX_BIN_REL_LEN);
+}
+
+static UBool reader_rewind(reader_t *this, error_t **error, UBool in_memory)
+{
+    UBool ret;
+
+    require_else_return_false(NULL != this);
+
+    if (in_memory) {
+        this->utf16.ptr = this->utf16.buffer;
+        /**
+         * ucnv_detectUnicodeSignature() documentation says:
+         *
+         * The caller can ucnv_open() a converter using the charset name. The first code unit (UChar) from the start of the stream will
+         * be U+FEFF (the Unicode BOM/signature character) and can usually be ignored.
+         *
+         * For most Unicode charsets it is also possible to ignore the indicated number of initial stream bytes and start converting after
+         * them. However,there are stateful Unicode charsets (UTF-7 and BOCU-1) for which this will not work. Therefore, it is best to
+         * ignore the first output UChar instead of the input signature bytes.
+         **/
+        if (0 != this->signature_length && this->utf16.ptr < this->utf16.end) {
+            ++this->utf16.ptr;
+        }
+        ret = TRUE;
+    } else {
+        ucnv_resetToUnicode(this->ucnv);
+        select_decoder(this);
+        this->byte.ptr = this->byte.end = this->byte.buffer;
+        this->utf16.end = this->utf16.ptr = this->utf16.tail = this->utf16.buffer;
+        ret = this->imp->rewindTo(this->fp, error, this->signature_length);
+    }
+
+    return ret;
+}
+
+/* ==================== public implementation getter/setter ==================== */
+
+#ifdef DYNAMIC_READERS
+/* result of trydload for each of available_readers: 0 if not yet tried, 1 if loaded, -1 on failure */
+static int dloaded[ARRAY_SIZE(available_readers)];
+#endif /* DYNAMIC_READERS */
+
+/**
+ * Can available_readers[i] be used (not internal, library loaded)?
+ **/
+static UBool reader_imp_usable(size_t i)
+{
+    if (available_readers[i]->internal) {
+        return FALSE;
+    }
+#ifdef DYNAMIC_READERS
+    if (NULL != available_readers[i]->trydload) {
+        if (0 == dloaded[i]) {
+            dloaded[i] = available_readers[i]->trydload() ? 1 : -1;
+        }
+        return 1 == dloaded[i];
+    }
+#endif /* DYNAMIC_READERS */
+
+    return TRUE;
+}
+
+const reader_imp_t *reader_get_by_name(const char *name) /* NONNULL() */
+{
+    size_t i;
+
+    require_else_return_null(NULL != name);
+
+    for (i = 0; NULL != available_readers[i]; i++) {
+        if (0 == strcmp(available_readers[i]->name, name)) {
+            return reader_imp_usable(i) ? available_readers[i] : NULL;
+        }
+    }
+
+    return NULL;
 }
 
-static UBool reader_is_seekable(reader_t *this)
+UBool reader_set_imp_by_name(reader_t *this, const char *name) /* NONNULL() */
 {
+    const reader_imp_t *imp;
+
     require_else_return_false(NULL != this);
+    require_else_return_false(NULL != name);
+
+    if (0 == strcmp(AUTO_READER_NAME, name)) {
+        this->default_imp = this->imp = NULL;
+        return TRUE;
+    }
+    if (NULL == (imp = reader_get_by_name(name))) {
+        return FALSE;
+    }
+    this->default_imp = this->imp = imp;
 
-    return STDIN_FILENO != this->fd;
+    return TRUE;
 }
 
-#ifndef NO_PHYSICAL_REWIND
-static UBool reader_rewind(reader_t *this, error_t **error)
-#else
-static UBool reader_rewind(reader_t *this, error_t **UNUSED(error))
-#endif /* !NO_PHYSICAL_REWIND */
+/* ==================== public misc setter ==================== */
+
+void reader_set_binary_behavior(reader_t *this, int binbehave) /* NONNULL() */
 {
-    UBool ret;
+    require_else_return(NULL != this);
+    require_else_return(binbehave >= BIN_FILE_BIN && binbehave <= BIN_FILE_TEXT);
 
-    require_else_return_false(NULL != this);
+    this->binbehave = binbehave;
+}
 
-#ifndef NO_PHYSICAL_REWIND
-    this->byte.ptr = this->byte.buffer + this->signature_length;
-    this->utf16.end = this->utf16.ptr = this->utf16.buffer;
-    ret = this->imp->rewindTo(this->fp, error, this->signature_length);
-#else
-//     ucnv_reset(this->ucnv);
-//     ucnv_resetToUnicode(this->ucnv);
-    this->utf16.ptr = this->utf16.buffer;
-    /**
-     * ucnv_detectUnicodeSignature() documentation says:
-     *
-     * The caller can ucnv_open() a converter using the charset name. The first code unit (UChar) from the start of the stream will
-     * be U+FEFF (the Unicode BOM/signature character) and can usually be ignored.
-     *
-     * For most Unicode charsets it is also possible to ignore the indicated number of initial stream bytes and start converting after
-     * them. However,there are stateful Unicode charsets (UTF-7 and BOCU-1) for which this will not work. Therefore, it is best to
-     * ignore the first output UChar instead of the input signature bytes.
-     **/
-    if (0 != this->signature_length) {
-        ++this->utf16.ptr;
-    }
-    ret = TRUE;
-#endif /* !NO_PHYSICAL_REWIND */
+/**
+ * Bound the length of the views returned by reader_readline_view to size UChars
+ * (0 to not bound them): longer lines are returned as a sequence of windows
+ * which overlap on size / 2 UChars (see reader_t.window).
+ **/
+void reader_set_line_window(reader_t *this, int32_t size) /* NONNULL() */
+{
+    require_else_return(NULL != this);
+    require_else_return(0 == size || size >= MIN_LINE_WINDOW);
 
-    return ret;
+    this->window.size = size;
+    this->window.margin = size / 4;
 }
 
-/* ==================== public implementation getter/setter ==================== */
+/* ==================== converter pool ==================== */
 
-const reader_imp_t *reader_get_by_name(const char *name) /* NONNULL() */
-{
-    const reader_imp_t **imp;
+/**
+ * Converters released by readers (file closed, encoding changed) are kept,
+ * reset, to be reused for the next file in the same charset: opening a
+ * converter for a table based charset (Shift-JIS, GB18030, windows-125x,
+ * ...) loads and parses its mapping table. They are keyed by their name,
+ * which is the canonical one of the charset (see ucnv_getAlias).
+ **/
+static struct {
+    const char *name; /* NULL if the slot is free */
+    UConverter *ucnv;
+} converters[CONVERTER_POOL_SIZE];
+static size_t next_evicted = 0;
 
-    require_else_return_null(NULL != name);
+static void converter_pool_close(void *UNUSED(unused))
+{
+    size_t i;
 
-    for (imp = available_readers; NULL != *imp; imp++) {
-        if (0 == strcmp((*imp)->name, name)) {
-#ifdef DYNAMIC_READERS
-            if ((*imp)->internal || (NULL != (*imp)->trydload && !(*imp)->trydload())) {
-#else
-            if ((*imp)->internal) {
-#endif /* DYNAMIC_READERS */
-                return NULL;
-            } else {
-                return *imp;
-            }
+    for (i = 0; i < ARRAY_SIZE(converters); i++) {
+        if (NULL != converters[i].name) {
+            ucnv_close(converters[i].ucnv);
+            converters[i].name = NULL;
         }
     }
-
-    return NULL;
 }
 
-UBool reader_set_imp_by_name(reader_t *this, const char *name) /* NONNULL() */
+/**
+ * Get a converter for encoding (NULL for the default one), from the pool
+ * if there is one, else a newly opened one
+ **/
+static UConverter *converter_pool_get(const char *encoding, UErrorCode *status)
 {
-    const reader_imp_t **imp;
-
-    require_else_return_false(NULL != this);
-    require_else_return_false(NULL != name);
+    size_t i;
+    const char *name;
+    UErrorCode aliasstatus;
 
-    for (imp = available_readers; NULL != *imp; imp++) {
-        if (0 == strcmp((*imp)->name, name)) {
-#ifdef DYNAMIC_READERS
-            if ((*imp)->internal || (NULL != (*imp)->trydload && !(*imp)->trydload())) {
-#else
-            if ((*imp)->internal) {
-#endif /* DYNAMIC_READERS */
-                return FALSE;
-            } else {
-                this->default_imp = this->imp = *imp;
-                return TRUE;
+    aliasstatus = U_ZERO_ERROR;
+    if (NULL == encoding) {
+        name = ucnv_getDefaultName();
+    } else {
+        name = ucnv_getAlias(encoding, 0, &aliasstatus);
+    }
+    if (U_SUCCESS(aliasstatus) && NULL != name) {
+        for (i = 0; i < ARRAY_SIZE(converters); i++) {
+            if (NULL != converters[i].name && !strcmp(converters[i].name, name)) {
+                converters[i].name = NULL;
+                return converters[i].ucnv;
             }
         }
     }
 
-    return FALSE;
+    return ucnv_open(encoding, status);
 }
 
-/* ==================== public misc setter ==================== */
-
-void reader_set_binary_behavior(reader_t *this, int binbehave) /* NONNULL() */
+/**
+ * Give back a converter to the pool: the oldest pooled one is closed if it is full
+ **/
+static void converter_pool_put(UConverter *ucnv)
 {
-    require_else_return(NULL != this);
-    require_else_return(binbehave >= BIN_FILE_BIN && binbehave <= BIN_FILE_TEXT);
+    size_t i;
+    const char *name;
+    UErrorCode status;
+    static UBool registered = FALSE;
 
-    this->binbehave = binbehave;
+    status = U_ZERO_ERROR;
+    name = ucnv_getName(ucnv, &status);
+    if (U_FAILURE(status)) {
+        ucnv_close(ucnv);
+        return;
+    }
+    if (!registered) {
+        env_register_resource(converters, (func_dtor_t) converter_pool_close);
+        registered = TRUE;
+    }
+    ucnv_reset(ucnv);
+    for (i = 0; i < ARRAY_SIZE(converters); i++) {
+        if (NULL == converters[i].name) {
+            break;
+        }
+    }
+    if (i >= ARRAY_SIZE(converters)) {
+        i = next_evicted;
+        next_evicted = (next_evicted + 1) % ARRAY_SIZE(converters);
+        ucnv_close(converters[i].ucnv);
+    }
+    converters[i].name = name;
+    converters[i].ucnv = ucnv;
 }
 
 /* ==================== public encoding setters ==================== */
@@ -411,11 +1237,13 @@ UBool reader_set_encoding(reader_t *this, error_t **error, const char *encoding)
 
     status = U_ZERO_ERROR;
     if (NULL != this->ucnv) {
-        ucnv_close(this->ucnv);
+        converter_pool_put(this->ucnv);
     }
-    this->ucnv = ucnv_open(encoding, &status);
+    this->ucnv = converter_pool_get(encoding, &status);
     if (U_FAILURE(status)) {
         icu_error_set(error, FATAL, status, "ucnv_open");
+    } else {
+        select_decoder(this);
     }
     this->encoding = encoding;
 
@@ -445,6 +1273,31 @@ void reader_set_user_data(reader_t *this, void *data) /* NONNULL(1) */
     this->priv_user = data;
 }
 
+/* ==================== private buffers management ==================== */
+
+/**
+ * Buffers are allocated on first use, sized from the global --buffer-size
+ * setting, then kept (and maybe grown) from one input to the next
+ **/
+static void reader_reset_buffers(reader_t *this)
+{
+    size_t size;
+
+    if (NULL == this->byte.buffer) {
+        size = env_get_buffer_size();
+        this->byte.buffer = buffer_renew(NULL, 0, size);
+        this->byte.limit = this->byte.buffer + size;
+        this->utf16.buffer = buffer_renew(NULL, 0, size * sizeof(*this->utf16.buffer));
+        this->utf16.limit = this->utf16.buffer + size;
+    }
+    this->byte.ptr = this->byte.end = this->byte.buffer;
+    this->utf16.ptr = this->utf16.end = this->utf16.tail = this->utf16.buffer;
+    this->raw.ptr = this->raw.end = NULL;
+    this->normalization.instance = ustring_get_normalizer(env_get_normalization());
+    this->window.continued = this->window.partial = FALSE;
+    this->window.hole = NULL;
+}
+
 /* ==================== public "hacks" for special cases ==================== */
 
 UBool reader_open_stdin(reader_t *this, error_t **error) /* NONNULL(1) */
@@ -453,8 +1306,6 @@ UBool reader_open_stdin(reader_t *this, error_t **error) /* NONNULL(1) */
 
     require_else_return_false(NULL != this);
 
-    reader_init(this, "stdio");
-
     ret = reader_open(this, error, "-");
     if (!reader_set_encoding(this, error, env_get_stdin_encoding())) { /* NULL <=> inherit system encoding */
         return FALSE;
@@ -469,13 +1320,16 @@ UBool reader_open_string(reader_t *this, error_t **error, const char *string) /*
     require_else_return_false(NULL != this);
     require_else_return_false(NULL != string);
 
-    reader_init(this, NULL);
     this->fd = 0;
     this->imp = &string_reader_imp;
     this->sourcename = "(string)";
     if (NULL == (this->fp = string_open(string, -1))) {
         return FALSE;
     }
+    this->lineno = 0;
+    this->binary = FALSE;
+    this->signature_length = 0;
+    reader_reset_buffers(this);
     if (!reader_set_encoding(this, error, env_get_stdin_encoding())) { /* NULL <=> inherit system encoding */
         return FALSE;
     }
@@ -490,7 +1344,7 @@ UBool reader_eof(reader_t *this) /* NONNULL() */
 {
     require_else_return_false(NULL != this);
 
-    return this->imp->eof(this->fp) && this->utf16.end == this->utf16.ptr /*&& this->byte.end == this->byte.buffer*/;
+    return this->imp->eof(this->fp) && this->utf16.end == this->utf16.ptr && this->raw.end == this->raw.ptr /*&& this->byte.end == this->byte.buffer*/;
 }
 
 void reader_init(reader_t *this, const char *name) /* NONNULL(1) */
@@ -514,25 +1368,35 @@ void reader_init(reader_t *this, const char *name) /* NONNULL(1) */
     this->lineno = 0;
     this->binary = FALSE;
     this->ucnv = NULL;
-    this->byte.limit = this->byte.buffer + CHAR_BUFFER_SIZE;
-    this->utf16.limit = this->utf16.buffer + UCHAR_BUFFER_SIZE;
-    this->byte.ptr = this->byte.end = this->byte.buffer;
-    this->utf16.ptr = this->utf16.end = this->utf16.buffer;
+    this->decoder = DECODER_ICU;
+    this->byte.buffer = this->byte.ptr = this->byte.end = NULL;
+    this->byte.limit = NULL;
+    this->utf16.buffer = this->utf16.ptr = this->utf16.end = this->utf16.tail = NULL;
+    this->utf16.limit = NULL;
+    this->raw.ptr = this->raw.end = NULL;
+    this->normalization.instance = NULL;
+    this->normalization.buffer = NULL;
+    this->normalization.size = 0;
+    this->archive.fp = NULL;
+    this->archive.fd = -1;
+    this->window.size = this->window.margin = 0;
+    this->window.continued = this->window.partial = FALSE;
+    this->window.hole = NULL;
 }
 
 void reader_close(reader_t *this) /* NONNULL() */
 {
     require_else_return(NULL != this);
 
-    if (NULL != this->imp->close && NULL != this->fp) {
+    if (NULL != this->imp && NULL != this->imp->close && NULL != this->fp) {
         this->imp->close(this->fp);
     }
     this->fp = NULL;
     if (NULL != this->ucnv) {
-        ucnv_close(this->ucnv);
+        converter_pool_put(this->ucnv);
         this->ucnv = NULL;
     }
-    if (this->fd > 0 && STDIN_FILENO != this->fd) {
+    if (this->fd > 0 && STDIN_FILENO != this->fd && this->archive.fd != this->fd) {
         close(this->fd);
     }
     this->fd = -1;
@@ -542,7 +1406,22 @@ static void reader_destroy(reader_t *this) /* NONNULL() */
 {
     require_else_return(NULL != this);
 
+    /* the pool may already be gone */
+    if (NULL != this->ucnv) {
+        ucnv_close(this->ucnv);
+        this->ucnv = NULL;
+    }
     reader_close(this);
+    reader_archive_close(this);
+    if (NULL != this->byte.buffer) {
+        free(this->byte.buffer);
+    }
+    if (NULL != this->utf16.buffer) {
+        free(this->utf16.buffer);
+    }
+    if (NULL != this->normalization.buffer) {
+        free(this->normalization.buffer);
+    }
     free(this);
 }
 
@@ -557,98 +1436,289 @@ reader_t *reader_new(const char *name)
     return this;
 }
 
-UBool reader_open(reader_t *this, error_t **error, const char *filename) /* NONNULL(1, 3) */
+/**
+ * The charset detector is shared by all readers: opening it is far from
+ * free and it would be done for each file otherwise
+ **/
+static UCharsetDetector *csd = NULL;
+
+static UBool detect_encoding(error_t **error, const char *buffer, int32_t buffer_len, const char **encoding)
 {
+    int32_t confidence;
     UErrorCode status;
-    size_t buffer_len;
-    const char *encoding;
-    char buffer[MAX_ENC_REL_LEN + 1] = { 0 };
+    const char *tmpencoding;
+    const UCharsetMatch *ucm;
 
-    require_else_return_false(NULL != this);
-    require_else_return_false(NULL != filename);
+    status = U_ZERO_ERROR;
+    if (NULL == csd) {
+        csd = ucsdet_open(&status);
+        if (U_FAILURE(status)) {
+            icu_error_set(error, WARN, status, "ucsdet_open");
+            csd = NULL;
+            return FALSE;
+        }
+        env_register_resource(csd, (func_dtor_t) ucsdet_close);
+    }
+    ucsdet_setText(csd, buffer, buffer_len, &status);
+    if (U_FAILURE(status)) {
+        icu_error_set(error, WARN, status, "ucsdet_setText");
+        return FALSE;
+    }
+    ucm = ucsdet_detect(csd, &status);
+    if (NULL != ucm) {
+        if (U_FAILURE(status)) {
+            icu_error_set(error, WARN, status, "ucsdet_detect");
+            return FALSE;
+        }
+        confidence = ucsdet_getConfidence(ucm, &status);
+        tmpencoding = ucsdet_getName(ucm, &status);
+        if (U_FAILURE(status)) {
+            icu_error_set(error, WARN, status, "ucsdet_getName");
+            return FALSE;
+        }
+        if (confidence > MIN_CONFIDENCE) {
+            *encoding = tmpencoding;
+            //debug("confidence of " GREEN("%d%%") " for " YELLOW("%s"), confidence, tmpencoding);
+        } else {
+            //debug("confidence of " RED("%d%%") " for " YELLOW("%s"), confidence, tmpencoding);
+            //encoding = "US-ASCII";
+        }
+    }
+
+    return TRUE;
+}
+
+#define MAX_MAGIC_LEN 10
+
+enum {
+    HEADER_MISMATCH,  /* not compressed in this format */
+    HEADER_PLAUSIBLE, /* only the magic string matches: the file may as well be text */
+    HEADER_CONFIRMED  /* compressed in this format (an error is a corruption) */
+};
+
+/**
+ * A magic string of 2 to 4 bytes can as well start a text file: check
+ * the fields which follow it before assuming the file is compressed
+ * - gzip (RFC 1952): compression method (CM) is 8 (deflate) and reserved
+ *   bits of FLG are clear
+ * - bzip2: "BZh" is followed by the block size ('1' to '9') then by the
+ *   48 bits magic number of the first block or of the end of stream
+ * - xz: its 6 bytes magic string, with a NUL, is enough
+ * Others (zstd) are only plausible.
+ **/
+static int magic_header_check(const reader_imp_t *imp, const char *header, size_t header_len)
+{
+    const uint8_t *p;
+
+    p = (const uint8_t *) header;
+    if (!strcmp("gzip", imp->name)) {
+        return header_len >= 4 && 8 == p[2] && 0 == (p[3] & 0xE0) ? HEADER_CONFIRMED : HEADER_MISMATCH;
+    } else if (!strcmp("bzip2", imp->name)) {
+        return header_len >= 10 && p[3] >= '1' && p[3] <= '9'
+            && (0 == memcmp(p + 4, "\x31\x41\x59\x26\x53\x59", 6) || 0 == memcmp(p + 4, "\x17\x72\x45\x38\x50\x90", 6)) ? HEADER_CONFIRMED : HEADER_MISMATCH;
+    } else if (!strcmp("lzma", imp->name)) {
+        return HEADER_CONFIRMED;
+    }
+
+    return HEADER_PLAUSIBLE;
+}
+
+/**
+ * stdio for small files, mmap for large ones
+ **/
+static const reader_imp_t *reader_select_plain_imp(const struct stat *st)
+{
+    return st->st_size < env_get_mmap_threshold() ? &stdio_reader_imp : &mmap_reader_imp;
+}
+
+/**
+ * Choose an implementation for the file opened on this->fd, when none was
+ * imposed:
+ * - the decompressor which recognizes the first bytes of a regular file
+ * - read(2) for anything which is not a regular file (pipes, FIFOs,
+ *   devices: their first bytes can't be peeked)
+ * - stdio for small files
+ * - mmap for large regular files
+ * *plausible is set to TRUE if a decompressor is chosen on its magic string
+ * only (see magic_header_check)
+ **/
+static const reader_imp_t *reader_select_imp(reader_t *this, UBool *plausible)
+{
+    int header;
+    size_t i;
+    ssize_t magic_len;
+    struct stat st;
+    char magic[MAX_MAGIC_LEN];
+
+    if (-1 == fstat(this->fd, &st) || !S_ISREG(st.st_mode)) {
+        return &pipe_reader_imp;
+    }
+    if ((magic_len = pread(this->fd, magic, sizeof(magic), 0)) > 0) {
+        for (i = 0; NULL != available_readers[i]; i++) {
+            if (NULL != available_readers[i]->magic && (size_t) magic_len >= strlen(available_readers[i]->magic)
+                && 0 == memcmp(magic, available_readers[i]->magic, strlen(available_readers[i]->magic))
+                && HEADER_MISMATCH != (header = magic_header_check(available_readers[i], magic, (size_t) magic_len))
+                && reader_imp_usable(i)
+            ) {
+                debug("%s, compressed file : %s", this->sourcename, available_readers[i]->name);
+                *plausible = HEADER_PLAUSIBLE == header;
+                return available_readers[i];
+            }
+        }
+    }
 
+    return reader_select_plain_imp(&st);
+}
+
+/**
+ * Open filename ("-" for standard input) and choose the implementation
+ * to read it (this->fd and this->imp). *plausible is set to TRUE if the
+ * file may not be compressed after all (see reader_select_imp)
+ * Return FALSE if the file can't be opened or is skipped (see skip_file)
+ **/
+static UBool reader_open_fd(reader_t *this, error_t **error, const char *filename, UBool *plausible)
+{
+    *plausible = FALSE;
     if (!strcmp("-", filename)) {
+        struct stat st;
+
         this->sourcename = "(standard input)";
-        this->imp = &stdio_reader_imp;
         this->fd = STDIN_FILENO;
+        if (-1 != fstat(this->fd, &st) && S_ISREG(st.st_mode)) {
+            this->imp = &stdio_reader_imp;
+        } else {
+            this->imp = &pipe_reader_imp;
+        }
     } else {
         this->imp = this->default_imp;
         this->sourcename = filename;
         if (-1 == (this->fd = open(filename, O_RDONLY))) {
             error_set(error, WARN, "can't open %s: %s", filename, strerror(errno));
-            goto failed;
+            return FALSE;
         }
 #ifdef WITH_FTS
         if (skip_file(this->fd)) {
-            goto failed;
+            return FALSE;
         }
 #endif /* WITH_FTS */
+        if (NULL == this->imp) {
+            this->imp = reader_select_imp(this, plausible);
+        }
     }
 
-    if (NULL == (this->fp = this->imp->dopen(error, this->fd, this->sourcename))) {
-        goto failed;
+    return TRUE;
+}
+
+/**
+ * The decompressor chosen by reader_select_imp on the magic string of the
+ * file only rejects it (not compressed after all): reopen it to read it as
+ * is. sniff_error, the reason of the rejection, is discarded.
+ **/
+static UBool reader_fallback_imp(reader_t *this, error_t **error, error_t **sniff_error)
+{
+    struct stat st;
+
+    debug("%s, rejected by %s, read as is", this->sourcename, this->imp->name);
+    if (NULL != *sniff_error) {
+        error_destroy(*sniff_error);
+        *sniff_error = NULL;
+    }
+    reader_close(this);
+    if (-1 == (this->fd = open(this->sourcename, O_RDONLY))) {
+        error_set(error, WARN, "can't open %s: %s", this->sourcename, strerror(errno));
+        return FALSE;
+    }
+    if (-1 == fstat(this->fd, &st)) {
+        error_set(error, WARN, "can't stat %s: %s", this->sourcename, strerror(errno));
+        return FALSE;
+    }
+    this->imp = reader_select_plain_imp(&st);
+
+    return NULL != (this->fp = this->imp->dopen(error, this->fd, this->sourcename));
+}
+
+UBool reader_open(reader_t *this, error_t **error, const char *filename) /* NONNULL(1, 3) */
+{
+    int binary;
+    UBool in_memory, seekable, sniffed;
+    UErrorCode status;
+    int32_t buffer_len;
+    error_t *sniff_error;
+    const char *encoding;
+    char buffer[MAX_ENC_REL_LEN + 1] = { 0 };
+
+    require_else_return_false(NULL != this);
+    require_else_return_false(NULL != filename);
+
+    sniffed = FALSE;
+    sniff_error = NULL;
+    if (NULL != this->archive.fp) {
+        /* the current member of the archive (see reader_archive_next) */
+        this->sourcename = filename;
+        this->imp = &archive_reader_imp;
+        this->fd = this->archive.fd;
+        this->fp = this->archive.fp;
+    } else {
+        /* a decompressor chosen on the magic string of the file only may still reject it */
+        if (!reader_open_fd(this, error, filename, &sniffed)) {
+            goto failed;
+        }
+        if (NULL == (this->fp = this->imp->dopen(sniffed ? &sniff_error : error, this->fd, this->sourcename))) {
+            if (!sniffed || !reader_fallback_imp(this, error, &sniff_error)) {
+                goto failed;
+            }
+            sniffed = FALSE;
+        }
     }
 
     //this->ucnv = NULL;
     //encoding = NULL;
+    binary = -1;
     buffer_len = 0;
     encoding = env_get_inputs_encoding();
     status = U_ZERO_ERROR;
     this->lineno = 0;
     this->binary = FALSE;
     this->signature_length = 0;
-    this->byte.ptr = this->byte.end = this->byte.buffer;
-    this->utf16.ptr = this->utf16.end = this->utf16.buffer;
-
-    if (reader_is_seekable(this)) {
-        if ((buffer_len = this->imp->readBytes(this->fp, error, buffer, MAX_ENC_REL_LEN)) > 0) {
-#ifdef NO_PHYSICAL_REWIND
-            memcpy(this->byte.buffer, buffer, buffer_len);
-            this->byte.end = this->byte.buffer + buffer_len;
-#endif /* NO_PHYSICAL_REWIND */
+    reader_reset_buffers(this);
+    in_memory = reader_can_rewind_in_memory(this);
+    seekable = reader_is_seekable(this);
+
+    if (seekable) {
+        if (-1 == (buffer_len = this->imp->readBytes(this->fp, sniffed ? &sniff_error : error, buffer, MAX_ENC_REL_LEN))) {
+            if (!sniffed || !reader_fallback_imp(this, error, &sniff_error)) {
+                goto failed;
+            }
+            if (-1 == (buffer_len = this->imp->readBytes(this->fp, error, buffer, MAX_ENC_REL_LEN))) {
+                goto failed;
+            }
+        }
+        if (buffer_len > 0) {
+            if (in_memory) {
+                memcpy(this->byte.buffer, buffer, buffer_len);
+                this->byte.end = this->byte.buffer + buffer_len;
+            }
             buffer[buffer_len] = '\0';
+            if (BIN_FILE_TEXT != this->binbehave && has_nul_code_point(buffer, buffer_len)) {
+                binary = TRUE;
+                if (BIN_FILE_SKIP == this->binbehave) {
+                    debug("%s, binary file : %s", filename, RED("yes"));
+                    goto failed;
+                }
+            }
             encoding = ucnv_detectUnicodeSignature(buffer, buffer_len, &this->signature_length, &status);
             if (U_SUCCESS(status)) {
                 if (NULL == encoding) {
-                    int32_t confidence;
-                    UCharsetDetector *csd;
-                    const char *tmpencoding;
-                    const UCharsetMatch *ucm;
-
-                    csd = ucsdet_open(&status);
-                    if (U_FAILURE(status)) {
-                        icu_error_set(error, WARN, status, "ucsdet_open");
-                        goto failed;
-                    }
-                    ucsdet_setText(csd, buffer, buffer_len, &status);
-                    if (U_FAILURE(status)) {
-                        icu_error_set(error, WARN, status, "ucsdet_setText");
-                        ucsdet_close(csd);
-                        goto failed;
-                    }
-                    ucm = ucsdet_detect(csd, &status);
-                    if (NULL != ucm) {
-                        if (U_FAILURE(status)) {
-                            icu_error_set(error, WARN, status, "ucsdet_detect");
-                            ucsdet_close(csd);
-                            goto failed;
-                        }
-                        confidence = ucsdet_getConfidence(ucm, &status);
-                        tmpencoding = ucsdet_getName(ucm, &status);
-                        if (U_FAILURE(status)) {
-                            icu_error_set(error, WARN, status, "ucsdet_getName");
-                            ucsdet_close(csd);
-                            goto failed;
-                        }
-                        if (confidence > MIN_CONFIDENCE) {
-                            encoding = tmpencoding;
-                            //debug("%s, confidence of " GREEN("%d%%") " for " YELLOW("%s"), filename, confidence, tmpencoding);
-                        } else {
-                            //debug("%s, confidence of " RED("%d%%") " for " YELLOW("%s"), filename, confidence, tmpencoding);
-                            //encoding = "US-ASCII";
+                    UBool ascii;
+
+                    if (utf8_is_valid(buffer, buffer + buffer_len, &ascii)) {
+                        /* as for a low confidence, pure ASCII is left to the default encoding */
+                        if (!ascii) {
+                            encoding = "UTF-8";
                         }
+                    } else if (!detect_encoding(error, buffer, buffer_len, &encoding)) {
+                        goto failed;
                     }
-                    ucsdet_close(csd);
                 }
                 //this->encoding = encoding;
             } else {
@@ -661,35 +1731,48 @@ UBool reader_open(reader_t *this, error_t **error, const char *filename) /* NONN
         goto failed;
     }
     debug("%s, file encoding = %s", this->sourcename, this->encoding);
-    if (reader_is_seekable(this)) {
-#ifdef NO_PHYSICAL_REWIND
-        {
+    if (seekable) {
+        if (BIN_FILE_TEXT != this->binbehave) {
+            if (-1 == binary) {
+                binary = sniff_binary(this, buffer, buffer_len);
+            }
+            if (-1 != binary) {
+                this->binary = binary;
+                debug("%s, binary file : %s", filename, this->binary ? RED("yes") : GREEN("no"));
+                if (this->binary && BIN_FILE_SKIP == this->binbehave) {
+                    goto failed;
+                }
+            }
+        }
+        if (in_memory) {
             UChar *utf16Ptr;
 
             utf16Ptr = this->utf16.buffer;
-            ucnv_toUnicode(
-                this->ucnv,
-                &utf16Ptr, this->utf16.limit,
-                (const char **) &this->byte.ptr, this->byte.end,
-                NULL,
-                this->imp->eof(this->fp),
-                &status
-            );
-            if (U_FAILURE(status)) {
-                icu_error_set(error, FATAL, status, "ucnv_toUnicode");
-                return FALSE;
+            if (!decode(this, error, &utf16Ptr, (const char **) &this->byte.ptr, this->byte.end, this->imp->eof(this->fp))) {
+                goto failed;
+            }
+            this->utf16.tail = utf16Ptr;
+            if (!normalize_buffer(this, error, this->imp->eof(this->fp))) {
+                goto failed;
             }
-            this->utf16.end = utf16Ptr;
         }
-#endif /* NO_PHYSICAL_REWIND */
-        if (!reader_rewind(this, error)) {
+        if (!reader_rewind(this, error, in_memory)) {
             goto failed;
         }
-        if (BIN_FILE_TEXT != this->binbehave) {
+        if (BIN_FILE_TEXT != this->binbehave && -1 == binary) {
             int32_t ubuffer_len;
             UChar32 ubuffer[MAX_BIN_REL_LEN + 1];
 
-            if (-1 == (ubuffer_len = reader_readuchars32(this, error, ubuffer, MAX_BIN_REL_LEN))) {
+            if (in_memory) {
+                /* don't refill the buffer: we need to keep its beginning to rewind */
+                int32_t i, length;
+
+                i = 0;
+                length = this->utf16.end - this->utf16.ptr;
+                for (ubuffer_len = 0; ubuffer_len < MAX_BIN_REL_LEN && i < length; ubuffer_len++) {
+                    U16_NEXT(this->utf16.ptr, i, length, ubuffer[ubuffer_len]);
+                }
+            } else if (-1 == (ubuffer_len = reader_readuchars32(this, error, ubuffer, MAX_BIN_REL_LEN))) {
                 goto failed;
             }
             ubuffer[ubuffer_len] = 0;
@@ -700,14 +1783,81 @@ UBool reader_open(reader_t *this, error_t **error, const char *filename) /* NONN
                     goto failed;
                 }
             }
-            if (!reader_rewind(this, error)) {
+            if (!reader_rewind(this, error, in_memory)) {
                 goto failed;
             }
         }
     }
 
+    return TRUE;
+failed:
+    if (NULL != sniff_error) {
+        error_propagate(error, sniff_error);
+    }
+    reader_close(this);
+    return FALSE;
+}
+
+/**
+ * Open filename, or standard input, to read its members if it is a tar or
+ * cpio archive (compressed or not): reader_archive_next moves from one to
+ * the next, each one is then read as any input, by reader_open then
+ * reader_readline and the like. The archive is decompressed and read in
+ * a single pass.
+ *
+ * Return FALSE on error
+ **/
+UBool reader_archive_open(reader_t *this, error_t **error, const char *filename) /* NONNULL(1, 3) */
+{
+    void *fp;
+    UBool plausible;
+
+    require_else_return_false(NULL != this);
+    require_else_return_false(NULL != filename);
+
+    if (!reader_open_fd(this, error, filename, &plausible)) {
+        goto failed;
+    }
+    if (NULL == (fp = this->imp->dopen(error, this->fd, this->sourcename))) {
+        goto failed;
+    }
+    if (NULL == (this->archive.fp = archive_open(error, this->imp, fp, this->sourcename))) {
+        this->imp->close(fp);
+        goto failed;
+    }
+    this->archive.fd = this->fd;
+    this->fd = -1;
+
     return TRUE;
 failed:
     reader_close(this);
     return FALSE;
 }
+
+/**
+ * Move to the next regular file of the archive
+ * Return its name (the one of the archive for anything else than a tar or
+ * cpio archive, a single member then), NULL when there is none left or on
+ * error (check error)
+ **/
+const char *reader_archive_next(reader_t *this, error_t **error) /* NONNULL(1) */
+{
+    require_else_return_null(NULL != this);
+    require_else_return_null(NULL != this->archive.fp);
+
+    return archive_next(this->archive.fp, error);
+}
+
+void reader_archive_close(reader_t *this) /* NONNULL() */
+{
+    require_else_return(NULL != this);
+
+    if (NULL != this->archive.fp) {
+        archive_close(this->archive.fp);
+        this->archive.fp = NULL;
+    }
+    if (this->archive.fd > 0 && STDIN_FILENO != this->archive.fd) {
+        close(this->archive.fd);
+    }
+    this->archive.fd = -1;
+}
@@ -8,21 +8,48 @@ enum {
     BIN_FILE_TEXT
 };
 
+enum {
+    DECODER_ICU,   /* ucnv_toUnicode */
+    DECODER_UTF8,  /* built-in, until an invalid sequence is met */
+    DECODER_ASCII, /* built-in, until a non-ASCII byte is met */
+    DECODER_UTF16, /* built-in (UTF-16 in the byte order of the host), until an unpaired surrogate is met */
+    DECODER_UTF16_SWAPPED /* built-in (UTF-16 in the other byte order), until an unpaired surrogate is met */
+};
+
+enum {
+    ADVICE_SEQUENTIAL = 1 << 0, /* (mmap) sequential access: more aggressive read-ahead */
+    ADVICE_WILLNEED   = 1 << 1, /* (mmap) start reading each window as soon as it is mapped */
+    ADVICE_DONTNEED   = 1 << 2, /* (mmap) release pages behind the scan position */
+    ADVICE_HUGEPAGE   = 1 << 3  /* transparent huge pages for large buffers */
+};
+
+# define DEFAULT_ADVICE (ADVICE_SEQUENTIAL | ADVICE_WILLNEED | ADVICE_DONTNEED)
+
+enum {
+    GZIP_INDEX_NONE, /* gzip files are read by gzread */
+    GZIP_INDEX_USE,  /* checkpoints are kept in memory (or loaded from the sidecar file) */
+    GZIP_INDEX_SAVE  /* and written to the sidecar file */
+};
+
+# define DEFAULT_GZIP_INDEX GZIP_INDEX_NONE
+
+enum {
+    ARCHIVE_FILE,   /* archives are read as any file */
+    ARCHIVE_MEMBERS /* each regular file of tar and cpio archives is read as an input */
+};
+
+# define DEFAULT_ARCHIVE ARCHIVE_FILE
+
 # define MIN_CONFIDENCE  39   // Minimum confidence for a match (in percents)
 # define MAX_ENC_REL_LEN 4096 // Maximum relevant length for encoding analyse (in bytes)
 # define MAX_BIN_REL_LEN 1024 // Maximum relevant length for binary analyse (in code points)
 
 # ifdef DEBUG
-#  define CHAR_BUFFER_SIZE  8
-#  define UCHAR_BUFFER_SIZE 8
+#  define DEFAULT_BUFFER_SIZE 8
 # else
-#  define CHAR_BUFFER_SIZE  BUFSIZ
-#  define UCHAR_BUFFER_SIZE BUFSIZ
+#  define DEFAULT_BUFFER_SIZE (256 * 1024)
 # endif /* DEBUG */
-
-# if (CHAR_BUFFER_SIZE > MAX_ENC_REL_LEN) && (UCHAR_BUFFER_SIZE > (4 * MAX_BIN_REL_LEN))
-#  define NO_PHYSICAL_REWIND 1
-# endif
+# define MIN_BUFFER_SIZE 8
 
 # ifdef DYNAMIC_READERS
 #  define DRNS(name) dl##name
@@ -76,6 +103,7 @@ enum {
 typedef struct {
     UBool internal;
     const char *name;
+    const char *magic; /* optional: first bytes of the (compressed) format, to recognize it */
 # ifdef DYNAMIC_READERS
     UBool (*trydload)(void);
 # endif /* DYNAMIC_READERS */
@@ -83,9 +111,8 @@ typedef struct {
     void (*close)(void *);
     UBool (*eof)(void *);
     int32_t (*readBytes)(void *, error_t **, char *, size_t);
-# ifndef NO_PHYSICAL_REWIND
     UBool (*rewindTo)(void *, error_t **, int32_t);
-# endif /* !NO_PHYSICAL_REWIND */
+    int32_t (*mapBytes)(void *, error_t **, const char **, size_t); /* optional: bytes are read in place, without copy */
 } reader_imp_t;
 
 typedef struct {
@@ -93,7 +120,7 @@ typedef struct {
     const char *sourcename;
     const char *default_encoding;
     const reader_imp_t *imp;
-    const reader_imp_t *default_imp;
+    const reader_imp_t *default_imp; /* NULL to choose for each file (see AUTO_READER_NAME) */
     void *priv_user;
     int binbehave;
     int32_t signature_length;
@@ -104,23 +131,66 @@ typedef struct {
     int fd;   /* this is not the responsability of imp to close it */
     void *fp; /* responsability of imp to free and/or close it if necessary */
     UConverter *ucnv;
+    int decoder;
     struct {
-        char buffer[CHAR_BUFFER_SIZE]; /* /!\ usage restricted to fill_buffer /!\ */
+        char *buffer;                  /* /!\ usage restricted to fill_buffer /!\ */
         char *ptr;                     /* /!\ usage restricted to fill_buffer /!\ */
         char *end;                     /* /!\ usage restricted to fill_buffer /!\ */
         const char *limit;             /* /!\ usage restricted to fill_buffer /!\ */
     } byte;
     struct {
-        UChar buffer[UCHAR_BUFFER_SIZE];
+        UChar *buffer;
         UChar *ptr;
         UChar *end;
+        UChar *tail;                   /* [end;tail[ is decoded but not yet normalized */
         const UChar *limit;
     } utf16;
+    struct {
+        const char *ptr; /* into byte.buffer or the implementation (mmap) */
+        const char *end;
+    } raw;
+    struct {
+        const UNormalizer2 *instance;  /* NULL if inputs are not normalized */
+        UChar *buffer;                 /* copy of what is being normalized */
+        size_t size;
+    } normalization;
+    struct {
+        void *fp; /* NULL if inputs are not archive members (see reader_archive_open) */
+        int fd;
+    } archive;
+    struct {
+        int32_t size;                  /* 0 if lines are never split (see reader_set_line_window) */
+        int32_t margin;                /* UChars, on each side of a window, shared with its neighbours */
+        UBool continued;               /* the last view is not the beginning of its line */
+        UBool partial;                 /* the last view is not the end of its line */
+        UChar *hole;                   /* NUL which terminates the last view in place of saved */
+        UChar saved;
+    } window;
 } reader_t;
 
-#define DEFAULT_READER_NAME "mmap"
+#define AUTO_READER_NAME "auto"
+#define DEFAULT_READER_NAME AUTO_READER_NAME
+
+# ifdef DEBUG
+#  define DEFAULT_MMAP_THRESHOLD 16
+# else
+#  define DEFAULT_MMAP_THRESHOLD (256 * 1024) /* what a single read(2) fills with the default --buffer-size */
+# endif /* DEBUG */
+
+# define MIN_LINE_WINDOW 16 /* UChars */
+
+# define CONVERTER_POOL_SIZE 8 /* converters kept, once released, for the next files */
+
+# define DEFAULT_THREADS 0 /* one by online processor */
+# define MAX_THREADS 64
+# define DEFAULT_MEMLIMIT 0 /* up to the decoder */
 
+void reader_archive_close(reader_t *) NONNULL();
+const char *reader_archive_next(reader_t *, error_t **) NONNULL(1);
+UBool reader_archive_open(reader_t *, error_t **, const char *) NONNULL(1, 3);
 void reader_close(reader_t *) NONNULL();
+UBool reader_decode_raw(reader_t *, error_t **, const char *, int32_t, UString *) NONNULL(1, 3, 5);
+UBool reader_copy_verbatim(reader_t *, error_t **, int) NONNULL(1);
 UBool reader_eof(reader_t *) NONNULL();
 const reader_imp_t *reader_get_by_name(const char *) NONNULL();
 void *reader_get_user_data(reader_t *) NONNULL();
@@ -130,6 +200,8 @@ UBool reader_open(reader_t *, error_t **, const char *) NONNULL(1, 3);
 UBool reader_open_stdin(reader_t *, error_t **) NONNULL(1);
 UBool reader_open_string(reader_t *, error_t **, const char *) NONNULL(1, 3);
 UBool reader_readline(reader_t *, error_t **, UString *) NONNULL(1, 3);
+UBool reader_readline_view(reader_t *, error_t **, UString *) NONNULL(1, 3);
+UBool reader_readline_raw(reader_t *, error_t **, const char **, int32_t *) NONNULL(1, 3, 4);
 UChar32 reader_readuchar32(reader_t *, error_t **) NONNULL(1);
 int32_t reader_readuchars(reader_t *, error_t **, UChar *, int32_t) NONNULL(1, 3);
 int32_t reader_readuchars32(reader_t *, error_t **, UChar32 *, int32_t) NONNULL(1, 3);
@@ -137,6 +209,8 @@ void reader_set_binary_behavior(reader_t *, int) NONNULL();
 void reader_set_default_encoding(reader_t *, const char *) NONNULL(1);
 UBool reader_set_encoding(reader_t *, error_t **, const char *) NONNULL(1);
 UBool reader_set_imp_by_name(reader_t *, const char *) NONNULL(1);
+void reader_set_line_window(reader_t *, int32_t) NONNULL();
 void reader_set_user_data(reader_t *, void *) NONNULL(1);
+UBool reader_start_raw(reader_t *, error_t **) NONNULL(1);
 
 #endif /* !READER_H */
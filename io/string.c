@@ -31,7 +31,6 @@ static UBool string_eof(void *fp)
     return this->ptr >= this->end;
 }
 
-#ifndef NO_PHYSICAL_REWIND
 static UBool string_rewindTo(void *fp, error_t **UNUSED(error), int32_t signature_length)
 {
     STRING *this;
@@ -41,9 +40,8 @@ static UBool string_rewindTo(void *fp, error_t **UNUSED(error), int32_t signatur
 
     return TRUE;
 }
-#endif /* !NO_PHYSICAL_REWIND */
 
-static int32_t string_readBytes(void *fp, error_t **UNUSED(error), char *buffer, size_t max_len)
+static int32_t string_mapBytes(void *fp, error_t **UNUSED(error), const char **bytes, size_t max_len)
 {
     int n;
     STRING *this;
@@ -54,16 +52,28 @@ static int32_t string_readBytes(void *fp, error_t **UNUSED(error), char *buffer,
     } else {
         n = this->end - this->ptr;
     }
-    memcpy(buffer, this->ptr, n);
+    *bytes = this->ptr;
     this->ptr += n;
 
     return n;
 }
 
+static int32_t string_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    int n;
+    const char *bytes;
+
+    n = string_mapBytes(fp, error, &bytes, max_len);
+    memcpy(buffer, bytes, n);
+
+    return n;
+}
+
 reader_imp_t string_reader_imp =
 {
     TRUE,
     "string",
+    NULL,
 #ifdef DYNAMIC_READERS
     NULL,
 #endif /* DYNAMIC_READERS */
@@ -71,7 +81,6 @@ reader_imp_t string_reader_imp =
     string_close,
     string_eof,
     string_readBytes
-#ifndef NO_PHYSICAL_REWIND
     , string_rewindTo
-#endif /* !NO_PHYSICAL_REWIND */
+    , string_mapBytes
 };
@@ -0,0 +1,509 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "common.h"
+
+/**
+ * Reader which keeps several reads in flight with io_uring: while a
+ * chunk is decoded and matched, the following ones are being read.
+ * Chunks are consumed in order and resubmitted, for the next part of
+ * the file, once fully consumed.
+ *
+ * liburing is not required: the (small) part of its API we need is
+ * done with the raw system calls.
+ *
+ * If io_uring is not available (old kernel, disabled by the system) or
+ * the input is not a regular file, reads are delegated to stdio.
+ **/
+
+extern reader_imp_t stdio_reader_imp;
+
+#ifdef DEBUG
+# define URING_CHUNK_SIZE 64
+#else
+# define URING_CHUNK_SIZE (1024 * 1024)
+#endif /* DEBUG */
+#define URING_DEPTH 4         /* number of chunks, and so reads in flight, by file */
+#define URING_ENTRIES 32      /* size of the submission queue, shared by all files */
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned inflight;
+    unsigned unsubmitted;
+    struct {
+        void *ring;
+        size_t ring_size;
+        unsigned *head, *tail, *mask, *array;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+    } sq;
+    struct {
+        void *ring;
+        size_t ring_size;
+        unsigned *head, *tail, *mask;
+        struct io_uring_cqe *cqes;
+    } cq;
+} RING;
+
+typedef struct {
+    char *data;
+    off_t offset;    /* position in the file of data */
+    size_t asked;    /* 0 if the chunk is idle (nothing left to read) */
+    int32_t len;     /* result of the read: bytes read or -errno */
+    int32_t pos;     /* consumed bytes */
+    UBool pending;
+    struct iovec iov;
+} CHUNK;
+
+typedef struct {
+    int fd;
+    void *stdio;     /* fallback */
+    char *buffer;    /* for mapBytes with the fallback */
+    off_t size;
+    off_t offset;    /* next read to submit */
+    off_t position;  /* next byte to give */
+    int count;
+    int current;
+    CHUNK chunks[URING_DEPTH];
+} URING;
+
+static RING ring;
+static int ring_status = 0; /* 0: not yet initialized, 1: available, -1: unavailable */
+
+static UBool ring_reap(error_t **);
+
+static void ring_destroy(RING *this)
+{
+    /* readers may be closed later: let their chunks be filled before the ring disappears */
+    while (this->inflight > 0 && ring_reap(NULL))
+        ;
+    munmap(this->sq.sqes, this->sq.sqes_size);
+    if (this->cq.ring != this->sq.ring) {
+        munmap(this->cq.ring, this->cq.ring_size);
+    }
+    munmap(this->sq.ring, this->sq.ring_size);
+    close(this->fd);
+}
+
+static UBool ring_init(void)
+{
+    struct io_uring_params p;
+
+    if (0 != ring_status) {
+        return 1 == ring_status;
+    }
+    ring_status = -1;
+    memset(&p, 0, sizeof(p));
+    if (-1 == (ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p))) {
+        debug("io_uring_setup failed: %s", strerror(errno));
+        return FALSE;
+    }
+    ring.entries = p.sq_entries;
+    ring.inflight = ring.unsubmitted = 0;
+    ring.sq.ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq.ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (0 != (p.features & IORING_FEAT_SINGLE_MMAP) && ring.cq.ring_size > ring.sq.ring_size) {
+        ring.sq.ring_size = ring.cq.ring_size;
+    }
+    ring.sq.ring = mmap(NULL, ring.sq.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring.sq.ring) {
+        goto close;
+    }
+    if (0 != (p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring.cq.ring = ring.sq.ring;
+    } else {
+        ring.cq.ring = mmap(NULL, ring.cq.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == ring.cq.ring) {
+            goto unmap_sq;
+        }
+    }
+    ring.sq.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sq.sqes = mmap(NULL, ring.sq.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring.sq.sqes) {
+        goto unmap_cq;
+    }
+    ring.sq.head = (unsigned *) ((char *) ring.sq.ring + p.sq_off.head);
+    ring.sq.tail = (unsigned *) ((char *) ring.sq.ring + p.sq_off.tail);
+    ring.sq.mask = (unsigned *) ((char *) ring.sq.ring + p.sq_off.ring_mask);
+    ring.sq.array = (unsigned *) ((char *) ring.sq.ring + p.sq_off.array);
+    ring.cq.head = (unsigned *) ((char *) ring.cq.ring + p.cq_off.head);
+    ring.cq.tail = (unsigned *) ((char *) ring.cq.ring + p.cq_off.tail);
+    ring.cq.mask = (unsigned *) ((char *) ring.cq.ring + p.cq_off.ring_mask);
+    ring.cq.cqes = (struct io_uring_cqe *) ((char *) ring.cq.ring + p.cq_off.cqes);
+    env_register_resource(&ring, (func_dtor_t) ring_destroy);
+    ring_status = 1;
+
+    return TRUE;
+
+unmap_cq:
+    if (ring.cq.ring != ring.sq.ring) {
+        munmap(ring.cq.ring, ring.cq.ring_size);
+    }
+unmap_sq:
+    munmap(ring.sq.ring, ring.sq.ring_size);
+close:
+    debug("io_uring mmap failed: %s", strerror(errno));
+    close(ring.fd);
+    return FALSE;
+}
+
+/**
+ * Submit queued reads and, if wait is TRUE, wait for at least one completion
+ **/
+static UBool ring_enter(error_t **error, UBool wait)
+{
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring.fd, ring.unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (-1 == ret && EINTR == errno);
+    if (-1 == ret) {
+        error_set(error, WARN, "io_uring_enter failed: %s", strerror(errno));
+        return FALSE;
+    }
+    ring.unsubmitted -= ret;
+
+    return TRUE;
+}
+
+/**
+ * Queue the read of the next part of the file into chunk, which becomes idle at the end of the file
+ **/
+static UBool uring_submit(URING *this, error_t **error, CHUNK *chunk, off_t offset, size_t length)
+{
+    unsigned tail, index;
+    struct io_uring_sqe *sqe;
+
+    if (0 == length || offset >= this->size) {
+        chunk->asked = 0;
+        chunk->pending = FALSE;
+        return TRUE;
+    }
+    tail = *ring.sq.tail;
+    if (tail - __atomic_load_n(ring.sq.head, __ATOMIC_ACQUIRE) >= ring.entries) {
+        if (!ring_enter(error, FALSE)) {
+            return FALSE;
+        }
+    }
+    chunk->offset = offset;
+    chunk->asked = length;
+    chunk->len = chunk->pos = 0;
+    chunk->pending = TRUE;
+    chunk->iov.iov_base = chunk->data;
+    chunk->iov.iov_len = length;
+    index = tail & *ring.sq.mask;
+    sqe = &ring.sq.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = this->fd;
+    sqe->off = offset;
+    sqe->addr = (unsigned long) &chunk->iov;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long) chunk;
+    ring.sq.array[index] = index;
+    __atomic_store_n(ring.sq.tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring.inflight;
+    ++ring.unsubmitted;
+
+    return TRUE;
+}
+
+/**
+ * Handle one completion, waiting for it if needed
+ **/
+static UBool ring_reap(error_t **error)
+{
+    CHUNK *c;
+    unsigned head;
+    struct io_uring_cqe *cqe;
+
+    head = *ring.cq.head;
+    while (head == __atomic_load_n(ring.cq.tail, __ATOMIC_ACQUIRE)) {
+        if (!ring_enter(error, TRUE)) {
+            return FALSE;
+        }
+    }
+    cqe = &ring.cq.cqes[head & *ring.cq.mask];
+    c = (CHUNK *) (unsigned long) cqe->user_data;
+    c->len = cqe->res;
+    c->pending = FALSE;
+    --ring.inflight;
+    __atomic_store_n(ring.cq.head, head + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+static UBool chunk_wait(CHUNK *chunk, error_t **error)
+{
+    while (chunk->pending) {
+        if (!ring_reap(error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static UBool uring_drain(URING *this, error_t **error)
+{
+    int i;
+
+    for (i = 0; i < this->count; i++) {
+        if (!chunk_wait(&this->chunks[i], error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * (Re)start reading at offset: all chunks are submitted for the following parts of the file
+ **/
+static UBool uring_start(URING *this, error_t **error, off_t offset)
+{
+    int i;
+    size_t length;
+
+    if (!uring_drain(this, error)) {
+        return FALSE;
+    }
+    this->current = 0;
+    this->position = this->offset = offset;
+    for (i = 0; i < this->count; i++) {
+        length = this->offset < this->size ? MIN(URING_CHUNK_SIZE, (size_t) (this->size - this->offset)) : 0;
+        if (!uring_submit(this, error, &this->chunks[i], this->offset, length)) {
+            return FALSE;
+        }
+        this->offset += length;
+    }
+
+    return 0 == ring.unsubmitted || ring_enter(error, FALSE);
+}
+
+/**
+ * Get the chunk which holds the next bytes, waiting for its read if needed.
+ * Consumed chunks are resubmitted here, not when they are consumed, so bytes
+ * given by mapBytes remain valid until the next call.
+ *
+ * Return 1 if *chunk holds bytes, 0 at the end of the file, -1 on error
+ **/
+static int uring_current(URING *this, error_t **error, CHUNK **chunk)
+{
+    CHUNK *c;
+    size_t length;
+
+    while (this->count > 0) {
+        c = &this->chunks[this->current];
+        if (0 == c->asked) {
+            break;
+        }
+        if (!chunk_wait(c, error)) {
+            return -1;
+        }
+        if (c->len < 0) {
+            error_set(error, WARN, "read failed: %s", strerror(-c->len));
+            return -1;
+        }
+        if (c->pos < c->len) {
+            *chunk = c;
+            return 1;
+        }
+        if (0 == c->len) {
+            /* the file was truncated */
+            this->size = this->position;
+            break;
+        }
+        if ((size_t) c->len < c->asked) {
+            /* short read: read the rest before going on to the next chunk */
+            if (!uring_submit(this, error, c, c->offset + c->len, c->asked - c->len)) {
+                return -1;
+            }
+        } else {
+            length = this->offset < this->size ? MIN(URING_CHUNK_SIZE, (size_t) (this->size - this->offset)) : 0;
+            if (!uring_submit(this, error, c, this->offset, length)) {
+                return -1;
+            }
+            this->offset += length;
+            this->current = (this->current + 1) % this->count;
+        }
+        if (0 != ring.unsubmitted && !ring_enter(error, FALSE)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Free the chunks and this once the kernel is done with them. If the ring
+ * can't be entered anymore, reads queued for them may still be submitted
+ * (by the next file): they are leaked rather than freed under the kernel.
+ **/
+static void uring_free(URING *this)
+{
+    int i;
+
+    if (!uring_drain(this, NULL)) {
+        for (i = 0; i < this->count; i++) {
+            if (this->chunks[i].pending) {
+                debug("io_uring reads still queued, their chunks are leaked");
+                return;
+            }
+        }
+    }
+    for (i = 0; i < this->count; i++) {
+        free(this->chunks[i].data);
+    }
+    free(this);
+}
+
+static void *uring_dopen(error_t **error, int fd, const char * const filename)
+{
+    int i;
+    URING *this;
+    struct stat st;
+
+    this = mem_new(*this);
+    this->fd = fd;
+    this->stdio = NULL;
+    this->buffer = NULL;
+    this->count = 0;
+    if (-1 == (fstat(fd, &st))) {
+        error_set(error, WARN, "can't stat %s: %s", filename, strerror(errno));
+        goto free;
+    }
+    if (!S_ISREG(st.st_mode) || !ring_init()) {
+        if (NULL == (this->stdio = stdio_reader_imp.dopen(error, fd, filename))) {
+            goto free;
+        }
+        this->buffer = mem_new_n(*this->buffer, URING_CHUNK_SIZE);
+        return this;
+    }
+    this->size = st.st_size;
+    for (i = 0; i < URING_DEPTH && (off_t) i * URING_CHUNK_SIZE < this->size; i++) {
+        this->chunks[i].data = mem_new_n(*this->chunks[i].data, MIN(URING_CHUNK_SIZE, (size_t) this->size));
+        this->chunks[i].pending = FALSE;
+    }
+    this->count = i;
+    if (!uring_start(this, error, 0)) {
+        /* reads may have been queued before the failure */
+        uring_free(this);
+        return NULL;
+    }
+
+    return this;
+
+free:
+    free(this);
+    return NULL;
+}
+
+static void uring_close(void *fp)
+{
+    URING *this;
+
+    this = (URING *) fp;
+    if (NULL != this->stdio) {
+        stdio_reader_imp.close(this->stdio);
+        free(this->buffer);
+        free(this);
+    } else {
+        /* the kernel may still write into the chunks */
+        uring_free(this);
+    }
+}
+
+static UBool uring_eof(void *fp)
+{
+    URING *this;
+
+    this = (URING *) fp;
+    if (NULL != this->stdio) {
+        return stdio_reader_imp.eof(this->stdio);
+    }
+
+    return this->position >= this->size;
+}
+
+static UBool uring_rewindTo(void *fp, error_t **error, int32_t signature_length)
+{
+    URING *this;
+
+    this = (URING *) fp;
+    if (NULL != this->stdio) {
+        return stdio_reader_imp.rewindTo(this->stdio, error, signature_length);
+    }
+
+    return uring_start(this, error, signature_length);
+}
+
+static int32_t uring_mapBytes(void *fp, error_t **error, const char **bytes, size_t max_len)
+{
+    int ret;
+    int32_t n;
+    CHUNK *chunk;
+    URING *this;
+
+    this = (URING *) fp;
+    if (NULL != this->stdio) {
+        *bytes = this->buffer;
+        return stdio_reader_imp.readBytes(this->stdio, error, this->buffer, MIN(max_len, URING_CHUNK_SIZE));
+    }
+    if (1 != (ret = uring_current(this, error, &chunk))) {
+        *bytes = NULL;
+        return ret;
+    }
+    n = MIN(max_len, (size_t) (chunk->len - chunk->pos));
+    *bytes = chunk->data + chunk->pos;
+    chunk->pos += n;
+    this->position += n;
+
+    return n;
+}
+
+static int32_t uring_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    int32_t n, total;
+    const char *bytes;
+    URING *this;
+
+    this = (URING *) fp;
+    if (NULL != this->stdio) {
+        return stdio_reader_imp.readBytes(this->stdio, error, buffer, max_len);
+    }
+    for (total = 0; (size_t) total < max_len; total += n) {
+        if (-1 == (n = uring_mapBytes(fp, error, &bytes, max_len - total))) {
+            return -1;
+        }
+        if (0 == n) {
+            break;
+        }
+        memcpy(buffer + total, bytes, n);
+    }
+
+    return total;
+}
+
+reader_imp_t uring_reader_imp =
+{
+    FALSE,
+    "uring",
+    NULL,
+#ifdef DYNAMIC_READERS
+    NULL,
+#endif /* DYNAMIC_READERS */
+    uring_dopen,
+    uring_close,
+    uring_eof,
+    uring_readBytes
+    , uring_rewindTo
+    , uring_mapBytes
+};
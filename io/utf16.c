@@ -0,0 +1,122 @@
+#include "common.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif /* __SSE2__ */
+
+/**
+ * Built-in decoder for UTF-16 in either byte order: input in the byte
+ * order of the host is already in our internal form and only has to be
+ * copied (after its surrogates are checked), input in the other one is
+ * byte swapped on the way.
+ *
+ * As the UTF-8 one, it only knows about well-formed input: it stops on the
+ * first unpaired surrogate and the caller is expected to hand the rest to
+ * ICU, which implements the substitution of invalid sequences.
+ **/
+
+static inline UChar swap16(UChar u)
+{
+    return (UChar) ((u << 8) | (u >> 8));
+}
+
+/**
+ * Copy (or byte swap) code units (by 8 with SSE2) until a surrogate is met
+ **/
+static void bmp_to_utf16(UChar **target, const UChar *targetLimit, const char **source, const char *sourceLimit, UBool swapped)
+{
+    UChar u, *t;
+    const char *s;
+#ifdef __SSE2__
+    __m128i chunk;
+    const __m128i mask = _mm_set1_epi16((short) 0xF800);
+    const __m128i surrogate = _mm_set1_epi16((short) 0xD800);
+#endif /* __SSE2__ */
+
+    t = *target;
+    s = *source;
+#ifdef __SSE2__
+    while (sourceLimit - s >= 16 && targetLimit - t >= 8) {
+        chunk = _mm_loadu_si128((const __m128i *) s);
+        if (swapped) {
+            chunk = _mm_or_si128(_mm_slli_epi16(chunk, 8), _mm_srli_epi16(chunk, 8));
+        }
+        if (0 != _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, mask), surrogate))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) t, chunk);
+        s += 16;
+        t += 8;
+    }
+#endif /* __SSE2__ */
+    while (sourceLimit - s >= 2 && t < targetLimit) {
+        memcpy(&u, s, sizeof(u));
+        if (swapped) {
+            u = swap16(u);
+        }
+        if (U16_IS_SURROGATE(u)) {
+            break;
+        }
+        *t++ = u;
+        s += 2;
+    }
+    *target = t;
+    *source = s;
+}
+
+/**
+ * Decode [*source;sourceLimit[, UTF-16 in the byte order of the host or,
+ * if swapped is TRUE, in the other one, into [*target;targetLimit[, both
+ * pointers being moved forward.
+ *
+ * Decoding stops:
+ * - when all input is consumed
+ * - when target is full
+ * - on a code unit or a surrogate pair truncated by sourceLimit (to be completed by the next call)
+ * - on an unpaired surrogate
+ *
+ * Return FALSE for the last case only, *source then points to the unpaired surrogate
+ **/
+UBool utf16_to_utf16(UChar **target, const UChar *targetLimit, const char **source, const char *sourceLimit, UBool swapped) /* NONNULL() */
+{
+    UBool valid;
+    UChar *t;
+    const char *s;
+    UChar lead, trail;
+
+    valid = TRUE;
+    t = *target;
+    s = *source;
+    while (sourceLimit - s >= 2 && t < targetLimit) {
+        bmp_to_utf16(&t, targetLimit, &s, sourceLimit, swapped);
+        if (sourceLimit - s < 2 || t >= targetLimit) {
+            break;
+        }
+        memcpy(&lead, s, sizeof(lead));
+        if (swapped) {
+            lead = swap16(lead);
+        }
+        if (!U16_IS_LEAD(lead)) {
+            valid = FALSE;
+            break;
+        }
+        if (sourceLimit - s < 4 || targetLimit - t < 2) {
+            break;
+        }
+        memcpy(&trail, s + 2, sizeof(trail));
+        if (swapped) {
+            trail = swap16(trail);
+        }
+        if (!U16_IS_TRAIL(trail)) {
+            valid = FALSE;
+            break;
+        }
+        *t++ = lead;
+        *t++ = trail;
+        s += 4;
+    }
+    *target = t;
+    *source = s;
+
+    return valid;
+}
@@ -0,0 +1,182 @@
+#include "common.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif /* __SSE2__ */
+
+/**
+ * Built-in decoder for UTF-8 and US-ASCII, the most common encodings
+ * for inputs, to not pay the cost of a generic ICU converter.
+ *
+ * It only knows about well-formed input: it stops on the first invalid
+ * sequence and the caller is expected to hand the rest to ICU, which
+ * implements the substitution of invalid sequences.
+ **/
+
+/**
+ * Widen ASCII bytes (by 16 with SSE2, else by 8) until a non-ASCII byte is met
+ **/
+static void ascii_to_utf16(UChar **target, const UChar *targetLimit, const uint8_t **source, const uint8_t *sourceLimit)
+{
+    UChar *t;
+    const uint8_t *s;
+#ifdef __SSE2__
+    __m128i chunk;
+    const __m128i zero = _mm_setzero_si128();
+#else
+    int i;
+    uint64_t chunk;
+#endif /* __SSE2__ */
+
+    t = *target;
+    s = *source;
+#ifdef __SSE2__
+    while (sourceLimit - s >= 16 && targetLimit - t >= 16) {
+        chunk = _mm_loadu_si128((const __m128i *) s);
+        if (0 != _mm_movemask_epi8(chunk)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) t, _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128((__m128i *) (t + 8), _mm_unpackhi_epi8(chunk, zero));
+        s += 16;
+        t += 16;
+    }
+#else
+    while (sourceLimit - s >= 8 && targetLimit - t >= 8) {
+        memcpy(&chunk, s, sizeof(chunk));
+        if (0 != (chunk & UINT64_C(0x8080808080808080))) {
+            break;
+        }
+        for (i = 0; i < 8; i++) {
+            t[i] = s[i];
+        }
+        s += 8;
+        t += 8;
+    }
+#endif /* __SSE2__ */
+    while (s < sourceLimit && t < targetLimit && *s < 0x80) {
+        *t++ = *s++;
+    }
+    *target = t;
+    *source = s;
+}
+
+/**
+ * Decode [*source;sourceLimit[ into [*target;targetLimit[, both pointers
+ * being moved forward.
+ *
+ * Decoding stops:
+ * - when all input is consumed
+ * - when target is full
+ * - on a sequence truncated by sourceLimit (to be completed by the next call)
+ * - on an invalid sequence (any non-ASCII byte when ascii_only is TRUE)
+ *
+ * Return FALSE for the last case only, *source then points to the invalid sequence
+ **/
+UBool utf8_to_utf16(UChar **target, const UChar *targetLimit, const char **source, const char *sourceLimit, UBool ascii_only) /* NONNULL() */
+{
+    UBool valid;
+    UChar32 c;
+    UChar *t;
+    int32_t i, length;
+    const uint8_t *s, *end;
+
+    valid = TRUE;
+    t = *target;
+    s = (const uint8_t *) *source;
+    end = (const uint8_t *) sourceLimit;
+    while (s < end && t < targetLimit) {
+        ascii_to_utf16(&t, targetLimit, &s, end);
+        if (s >= end || t >= targetLimit) {
+            break;
+        }
+        if (ascii_only) {
+            valid = FALSE;
+            break;
+        }
+        length = *s >= 0xF0 ? 4 : *s >= 0xE0 ? 3 : 2;
+        if (end - s < length || (4 == length && targetLimit - t < 2)) {
+            break;
+        }
+        i = 0;
+        U8_NEXT(s, i, length, c);
+        if (c < 0 || i != length) {
+            valid = FALSE;
+            break;
+        }
+        if (U_IS_BMP(c)) {
+            *t++ = (UChar) c;
+        } else {
+            *t++ = U16_LEAD(c);
+            *t++ = U16_TRAIL(c);
+        }
+        s += length;
+    }
+    *target = t;
+    *source = (const char *) s;
+
+    return valid;
+}
+
+/**
+ * Check if [p;end[ is well-formed UTF-8 without any NUL byte (which
+ * suggests UTF-16/32 or binary data), a sequence truncated by end being
+ * accepted. *ascii is set to TRUE if all bytes are ASCII.
+ *
+ * This is meant to skip the ICU charset detector for the most common inputs.
+ **/
+UBool utf8_is_valid(const char *p, const char *end, UBool *ascii) /* NONNULL() */
+{
+    UChar32 c;
+    int32_t i, length;
+    const uint8_t *s, *e;
+#ifdef __SSE2__
+    __m128i chunk;
+    const __m128i zero = _mm_setzero_si128();
+#endif /* __SSE2__ */
+
+    *ascii = TRUE;
+    s = (const uint8_t *) p;
+    e = (const uint8_t *) end;
+    while (s < e) {
+#ifdef __SSE2__
+        while (e - s >= 16) {
+            chunk = _mm_loadu_si128((const __m128i *) s);
+            if (0 != (_mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero)))) {
+                break;
+            }
+            s += 16;
+        }
+#endif /* __SSE2__ */
+        while (s < e && *s < 0x80) {
+            if (0 == *s++) {
+                return FALSE;
+            }
+        }
+        if (s >= e) {
+            break;
+        }
+        *ascii = FALSE;
+        length = *s >= 0xF0 ? 4 : *s >= 0xE0 ? 3 : 2;
+        if (e - s < length) {
+            /* truncated sequence: accept it if what remains can start a valid one */
+            if (*s < 0xC2 || *s > 0xF4) {
+                return FALSE;
+            }
+            for (s++; s < e; s++) {
+                if (!U8_IS_TRAIL(*s)) {
+                    return FALSE;
+                }
+            }
+            break;
+        }
+        i = 0;
+        U8_NEXT(s, i, length, c);
+        if (c < 0 || i != length) {
+            return FALSE;
+        }
+        s += length;
+    }
+
+    return TRUE;
+}
@@ -1,8 +1,39 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
 #include <errno.h>
 
 #include "common.h"
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+/**
+ * gzip files are inflated by gzread, except BGZF files (as written by
+ * bgzip, samtools...) when more than one thread is allowed (--threads).
+ *
+ * A BGZF file is a series of gzip members of at most 64 KiB, each one
+ * giving its size in an extra field of its header: they can be located
+ * without being inflated, so worker threads inflate the following ones
+ * while the output of the current one is consumed, in order.
+ * A member which is not a BGZF block (a regular gzip member appended to
+ * the file) ends the parallel inflation: the rest is read by gzread.
+ *
+ * Other multi-member files are inflated sequentially: the end of a
+ * member is only known once it is inflated.
+ *
+ * With --gzip-index, other gzip files are inflated by inflate, as zran.c
+ * (from the examples of zlib) does: at the end of a deflate block, every
+ * ZRAN_SPAN bytes of output, a checkpoint (position in the file, bit
+ * offset and last 32 KiB of output) is recorded, from which inflation can
+ * be resumed instead of starting again from the beginning of the file.
+ * With --gzip-index=save, the checkpoints are written to a sidecar file
+ * (<file>.zran) once the whole file is inflated, and loaded from it the
+ * next times, as long as the file is not modified.
+ **/
+
 #define DEBUG_READS 1
 
 #ifdef DYNAMIC_READERS
@@ -17,6 +48,16 @@ static int (*DRNS(gzread))(gzFile, voidp, unsigned) = NULL;
 static int (*DRNS(gzclose))(gzFile) = NULL;
 static int (*DRNS(gzeof))(gzFile) = NULL;
 static z_off_t (*DRNS(gzseek))(gzFile, z_off_t, int) = NULL;
+static int (*DRNS(inflateInit2_))(z_streamp, int, const char *, int) = NULL;
+static int (*DRNS(inflate))(z_streamp, int) = NULL;
+static int (*DRNS(inflateReset))(z_streamp) = NULL;
+static int (*DRNS(inflateReset2))(z_streamp, int) = NULL;
+static int (*DRNS(inflatePrime))(z_streamp, int, int) = NULL;
+static int (*DRNS(inflateSetDictionary))(z_streamp, const Bytef *, uInt) = NULL;
+static int (*DRNS(inflateEnd))(z_streamp) = NULL;
+# ifdef HAVE_PTHREAD
+static uLong (*DRNS(crc32))(uLong, const Bytef *, uInt) = NULL;
+# endif /* HAVE_PTHREAD */
 
 static UBool zlib_trydload(void)
 {
@@ -42,18 +83,861 @@ static UBool zlib_trydload(void)
     DL_GET_SYM(handle, DRNS(gzclose), "gzclose");
     DL_GET_SYM(handle, DRNS(gzeof), "gzeof");
     DL_GET_SYM(handle, DRNS(gzseek), "gzseek");
+    DL_GET_SYM(handle, DRNS(inflateInit2_), "inflateInit2_");
+    DL_GET_SYM(handle, DRNS(inflate), "inflate");
+    DL_GET_SYM(handle, DRNS(inflateReset), "inflateReset");
+    DL_GET_SYM(handle, DRNS(inflateReset2), "inflateReset2");
+    DL_GET_SYM(handle, DRNS(inflatePrime), "inflatePrime");
+    DL_GET_SYM(handle, DRNS(inflateSetDictionary), "inflateSetDictionary");
+    DL_GET_SYM(handle, DRNS(inflateEnd), "inflateEnd");
+# ifdef HAVE_PTHREAD
+    DL_GET_SYM(handle, DRNS(crc32), "crc32");
+# endif /* HAVE_PTHREAD */
     env_register_resource(handle, (func_dtor_t) DL_UNLOAD);
 
     return TRUE;
 }
 #endif /* DYNAMIC_READERS */
 
+#ifdef HAVE_PTHREAD
+# define BGZF_MAX_BLOCK_SIZE 65536
+# define BGZF_HEADER_SIZE 18            /* gzip header with the BC extra subfield only */
+# define BGZF_INPUT_SIZE (1024 * 1024)  /* compressed bytes read at once */
+# define BGZF_BLOCKS_BY_THREAD 4
+# ifdef DEBUG
+#  define BGZF_MIN_SIZE 0
+# else
+#  define BGZF_MIN_SIZE (1024 * 1024)   /* smaller files are not worth starting threads */
+# endif /* DEBUG */
+
+typedef struct {
+    UBool done;     /* inflated (or failed) */
+    int status;     /* Z_OK or the zlib error */
+    size_t in_len;
+    size_t out_len;
+    uint8_t in[BGZF_MAX_BLOCK_SIZE];
+    char out[BGZF_MAX_BLOCK_SIZE];
+} BLOCK;
+
+typedef struct {
+    int fd;
+    off_t tail;       /* position of a member which is not a BGZF block, -1 if none */
+    UBool exhausted;  /* no more block to read */
+    struct {
+        uint8_t *buffer;
+        size_t pos;
+        size_t len;
+        off_t offset; /* position in the file of buffer[len] */
+        UBool eof;
+    } input;
+    /* block of sequence number n is blocks[n % count] */
+    size_t count;
+    size_t current;   /* block being consumed */
+    size_t next;      /* next block to inflate */
+    size_t filled;    /* next block to read */
+    const char *ptr;  /* into the output of the current block, NULL if not yet waited for */
+    BLOCK *blocks;
+    UBool stop;
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;  /* a block was read or the workers have to stop */
+    pthread_cond_t done;  /* a block was inflated */
+} BGZF;
+#endif /* HAVE_PTHREAD */
+
+#define ZRAN_WINDOW_SIZE 32768            /* deflate distances are at most 32 KiB */
+#define ZRAN_INPUT_SIZE (128 * 1024)      /* compressed bytes read at once */
+#ifdef DEBUG
+# define ZRAN_SPAN (64 * 1024)
+#else
+# define ZRAN_SPAN (4 * 1024 * 1024)      /* output between two checkpoints */
+#endif /* DEBUG */
+#define ZRAN_SIDECAR_SUFFIX ".zran"
+#define ZRAN_SIDECAR_MAGIC "UGZRAN01"
+
+typedef struct {
+    uint64_t out;           /* offset in the output */
+    uint64_t in;            /* offset in the file of the first byte fully following the checkpoint */
+    int bits;               /* if not 0, bits of the previous byte which belong to the next block */
+    uint32_t size;          /* of window (less than ZRAN_WINDOW_SIZE near the beginning) */
+    unsigned char *window;  /* output which precedes the checkpoint */
+} CHECKPOINT;
+
+typedef struct {
+    int fd;
+    z_stream strm;
+    UBool raw;              /* resumed from a checkpoint: the gzip trailer of the member is not inflated */
+    UBool eof;
+    UBool loaded;           /* checkpoints come from the sidecar file */
+    error_t *pending;       /* error met after some output, reported by the next read */
+    char *sidecar;          /* path of the sidecar file, NULL if checkpoints are not saved */
+    uint64_t in;            /* offset in the file of the end of input */
+    uint64_t out;           /* offset in the output */
+    off_t size;             /* of the file, to check the sidecar file */
+    time_t mtime;           /* same */
+    size_t count, allocated;
+    CHECKPOINT *points;
+    unsigned char input[ZRAN_INPUT_SIZE];
+    unsigned char window[ZRAN_WINDOW_SIZE]; /* output at offset n is window[n % ZRAN_WINDOW_SIZE] */
+} ZRAN;
+
+/**
+ * Make at least wanted bytes available in input (less at end of file)
+ * Return the number of available bytes, -1 on error
+ **/
+static int zran_fill(ZRAN *this, error_t **error, size_t wanted)
+{
+    ssize_t ret;
+
+    if (this->strm.avail_in < wanted) {
+        memmove(this->input, this->strm.next_in, this->strm.avail_in);
+        this->strm.next_in = this->input;
+        while (this->strm.avail_in < wanted) {
+            if (-1 == (ret = read(this->fd, this->input + this->strm.avail_in, ZRAN_INPUT_SIZE - this->strm.avail_in))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                error_set(error, WARN, "read() failed: %s", strerror(errno));
+                return -1;
+            }
+            if (0 == ret) {
+                break;
+            }
+            this->strm.avail_in += ret;
+            this->in += ret;
+        }
+    }
+
+    return this->strm.avail_in;
+}
+
+static void zran_add_checkpoint(ZRAN *this)
+{
+    size_t i;
+    CHECKPOINT *point;
+
+    if (this->count == this->allocated) {
+        this->allocated = 0 == this->allocated ? 16 : this->allocated * 2;
+        this->points = mem_renew(this->points, *this->points, this->allocated);
+    }
+    point = &this->points[this->count++];
+    point->out = this->out;
+    point->in = this->in - this->strm.avail_in;
+    point->bits = this->strm.data_type & 7;
+    point->size = MIN(this->out, ZRAN_WINDOW_SIZE);
+    point->window = mem_new_n(*point->window, point->size);
+    for (i = 0; i < point->size; i++) {
+        point->window[i] = this->window[(point->out - point->size + i) % ZRAN_WINDOW_SIZE];
+    }
+}
+
+static UBool zran_put_u64(FILE *fp, uint64_t v)
+{
+    int i;
+    unsigned char buffer[8];
+
+    for (i = 0; i < 8; i++) {
+        buffer[i] = (v >> (8 * i)) & 0xFF;
+    }
+
+    return 1 == fwrite(buffer, sizeof(buffer), 1, fp);
+}
+
+static UBool zran_get_u64(FILE *fp, uint64_t *v)
+{
+    int i;
+    unsigned char buffer[8];
+
+    if (1 != fread(buffer, sizeof(buffer), 1, fp)) {
+        return FALSE;
+    }
+    for (*v = 0, i = 7; i >= 0; i--) {
+        *v = (*v << 8) | buffer[i];
+    }
+
+    return TRUE;
+}
+
+/**
+ * Write the checkpoints to the sidecar file. The file is all little endian
+ * integers of 64 bits: magic, size and modification time of the gzip file,
+ * number of checkpoints, then, for each one: offset in output, offset in
+ * file, bits, size of window and window itself (raw bytes)
+ **/
+static void zran_save(ZRAN *this)
+{
+    size_t i;
+    FILE *fp;
+    UBool ok;
+
+    if (NULL == (fp = fopen(this->sidecar, "wb"))) {
+        msg(WARN, "can't create gzip index %s: %s", this->sidecar, strerror(errno));
+        return;
+    }
+    ok = 1 == fwrite(ZRAN_SIDECAR_MAGIC, STR_LEN(ZRAN_SIDECAR_MAGIC), 1, fp)
+        && zran_put_u64(fp, (uint64_t) this->size)
+        && zran_put_u64(fp, (uint64_t) this->mtime)
+        && zran_put_u64(fp, this->count);
+    for (i = 0; ok && i < this->count; i++) {
+        ok = zran_put_u64(fp, this->points[i].out)
+            && zran_put_u64(fp, this->points[i].in)
+            && zran_put_u64(fp, this->points[i].bits)
+            && zran_put_u64(fp, this->points[i].size)
+            && 1 == fwrite(this->points[i].window, this->points[i].size, 1, fp);
+    }
+    if (0 != fclose(fp) || !ok) {
+        msg(WARN, "can't write gzip index %s: %s", this->sidecar, strerror(errno));
+        unlink(this->sidecar);
+    }
+}
+
+/**
+ * Load the checkpoints from the sidecar file at path, if it exists and is
+ * up to date. Nothing is loaded otherwise (they are built as the file is inflated).
+ **/
+static void zran_load(ZRAN *this, const char *path)
+{
+    FILE *fp;
+    size_t count;
+    CHECKPOINT *point;
+    char magic[STR_SIZE(ZRAN_SIDECAR_MAGIC)];
+    uint64_t size, mtime, n, bits, window_size;
+
+    if (NULL == (fp = fopen(path, "rb"))) {
+        return;
+    }
+    if (1 != fread(magic, STR_LEN(ZRAN_SIDECAR_MAGIC), 1, fp) || 0 != memcmp(magic, ZRAN_SIDECAR_MAGIC, STR_LEN(ZRAN_SIDECAR_MAGIC))
+        || !zran_get_u64(fp, &size) || !zran_get_u64(fp, &mtime) || !zran_get_u64(fp, &n)
+        || size != (uint64_t) this->size || mtime != (uint64_t) this->mtime
+    ) {
+        debug("%s: not a gzip index or out of date", path);
+        fclose(fp);
+        return;
+    }
+    for (count = 0; count < n; count++) {
+        if (this->count == this->allocated) {
+            this->allocated = 0 == this->allocated ? 16 : this->allocated * 2;
+            this->points = mem_renew(this->points, *this->points, this->allocated);
+        }
+        point = &this->points[this->count];
+        if (!zran_get_u64(fp, &point->out) || !zran_get_u64(fp, &point->in) || !zran_get_u64(fp, &bits) || !zran_get_u64(fp, &window_size)
+            || bits > 7 || window_size > ZRAN_WINDOW_SIZE || window_size > point->out || point->in > size
+            || (count > 0 && point->out <= point[-1].out)
+        ) {
+            break;
+        }
+        point->bits = (int) bits;
+        point->size = (uint32_t) window_size;
+        point->window = mem_new_n(*point->window, point->size);
+        if (1 != fread(point->window, point->size, 1, fp)) {
+            free(point->window);
+            break;
+        }
+        this->count++;
+    }
+    fclose(fp);
+    if (count != n) {
+        debug("%s: truncated or invalid gzip index", path);
+        while (this->count > 0) {
+            free(this->points[--this->count].window);
+        }
+        return;
+    }
+    this->loaded = TRUE;
+    debug("%s: %d checkpoints loaded", path, (int) this->count);
+}
+
+static void zran_close(ZRAN *this)
+{
+    size_t i;
+
+    for (i = 0; i < this->count; i++) {
+        free(this->points[i].window);
+    }
+    free(this->points);
+    free(this->sidecar);
+    if (NULL != this->pending) {
+        error_destroy(this->pending);
+    }
+    DRNS(inflateEnd)(&this->strm);
+    free(this);
+}
+
+/**
+ * Start inflating fd if it is a (regular) gzip file and --gzip-index is set
+ * Return NULL if it is not
+ **/
+static ZRAN *zran_open(int fd, const char * const filename)
+{
+    int mode;
+    ZRAN *this;
+    struct stat st;
+    unsigned char magic[2];
+
+    if (GZIP_INDEX_NONE == (mode = env_get_gzip_index()) || -1 == fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    /* gzread also reads plain files (--reader=gzip), this is left to it */
+    if (0 != lseek(fd, 0, SEEK_SET) || 2 != read(fd, magic, 2) || 0 != lseek(fd, 0, SEEK_SET) || 0x1F != magic[0] || 0x8B != magic[1]) {
+        lseek(fd, 0, SEEK_SET);
+        return NULL;
+    }
+    this = mem_new(*this);
+    memset(this, 0, sizeof(*this));
+    if (Z_OK != DRNS(inflateInit2_)(&this->strm, 15 + 32, ZLIB_VERSION, (int) sizeof(this->strm))) {
+        free(this);
+        return NULL;
+    }
+    this->fd = fd;
+    this->size = st.st_size;
+    this->mtime = st.st_mtime;
+    this->strm.next_in = this->input;
+    if (NULL != filename && STDIN_FILENO != fd) {
+        char *path;
+
+        path = mem_new_n(*path, strlen(filename) + STR_SIZE(ZRAN_SIDECAR_SUFFIX));
+        strcpy(path, filename);
+        strcat(path, ZRAN_SIDECAR_SUFFIX);
+        zran_load(this, path);
+        if (GZIP_INDEX_SAVE == mode && !this->loaded) {
+            this->sidecar = path;
+        } else {
+            free(path);
+        }
+    }
+
+    return this;
+}
+
+/**
+ * A member ended: continue with the next one, if any (trailing garbage
+ * is ignored, as gzread does)
+ **/
+static UBool zran_next_member(ZRAN *this, error_t **error)
+{
+    int n;
+
+    if (this->raw) {
+        /* skip the trailer (CRC32 and ISIZE) which is not known to inflate */
+        if (-1 == (n = zran_fill(this, error, 8))) {
+            return FALSE;
+        }
+        n = MIN(n, 8);
+        this->strm.next_in += n;
+        this->strm.avail_in -= n;
+        DRNS(inflateReset2)(&this->strm, 15 + 32);
+        this->raw = FALSE;
+    } else {
+        DRNS(inflateReset)(&this->strm);
+    }
+    if (-1 == (n = zran_fill(this, error, 2))) {
+        return FALSE;
+    }
+    if (n < 2 || 0x1F != this->strm.next_in[0] || 0x8B != this->strm.next_in[1]) {
+        this->eof = TRUE;
+        if (NULL != this->sidecar) {
+            /* everything was inflated: checkpoints are complete */
+            zran_save(this);
+            free(this->sidecar);
+            this->sidecar = NULL;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Inflate up to max_len bytes into buffer (discarded if buffer is NULL)
+ * Return the number of bytes, -1 on error. As gzread, the bytes inflated
+ * before an error are returned first, the error by the next call.
+ **/
+static int32_t zran_read(ZRAN *this, error_t **error, char *buffer, size_t max_len)
+{
+    int ret;
+    size_t n, pos;
+    int32_t total;
+    error_t *tmp_error;
+
+    if (NULL != this->pending) {
+        error_propagate(error, this->pending);
+        this->pending = NULL;
+        return -1;
+    }
+    tmp_error = NULL;
+    for (total = 0; (size_t) total < max_len && !this->eof; total += n) {
+        if (0 == this->strm.avail_in) {
+            if (-1 == zran_fill(this, &tmp_error, 1)) {
+                goto failed;
+            }
+            if (0 == this->strm.avail_in) {
+                error_set(&tmp_error, WARN, "zlib internal error from inflate(): unexpected end of file");
+                goto failed;
+            }
+        }
+        pos = this->out % ZRAN_WINDOW_SIZE;
+        this->strm.next_out = this->window + pos;
+        this->strm.avail_out = MIN(ZRAN_WINDOW_SIZE - pos, max_len - total);
+        n = this->strm.avail_out;
+        ret = DRNS(inflate)(&this->strm, Z_BLOCK);
+        n -= this->strm.avail_out;
+        if (NULL != buffer) {
+            memcpy(buffer + total, this->window + pos, n);
+        }
+        this->out += n;
+        switch (ret) {
+            case Z_OK:
+            case Z_BUF_ERROR:
+                break;
+            case Z_STREAM_END:
+                if (!zran_next_member(this, &tmp_error)) {
+                    total += n;
+                    goto failed;
+                }
+                continue;
+            default:
+                error_set(&tmp_error, WARN, "zlib internal error from inflate(): %s", NULL == this->strm.msg ? "invalid data" : this->strm.msg);
+                total += n;
+                goto failed;
+        }
+        /* end of a block, which is not the last one of the member */
+        if (128 == (this->strm.data_type & (128 | 64)) && this->out >= ZRAN_SPAN + (0 == this->count ? 0 : this->points[this->count - 1].out)) {
+            zran_add_checkpoint(this);
+        }
+    }
+
+    return total;
+failed:
+    if (total > 0) {
+        this->pending = tmp_error;
+        return total;
+    }
+    error_propagate(error, tmp_error);
+    return -1;
+}
+
+/**
+ * Go to offset in the output, from the closest checkpoint which precedes it
+ **/
+static UBool zran_seek(ZRAN *this, error_t **error, uint64_t offset)
+{
+    CHECKPOINT *point;
+    size_t i, lo, hi, pos;
+
+    /* met again if this offset is read past */
+    if (NULL != this->pending) {
+        error_destroy(this->pending);
+        this->pending = NULL;
+    }
+    point = NULL;
+    for (lo = 0, hi = this->count; lo < hi; ) {
+        i = lo + (hi - lo) / 2;
+        if (this->points[i].out <= offset) {
+            point = &this->points[i];
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+    if (offset < this->out || (NULL != point && point->out > this->out)) {
+        if (NULL == point) {
+            if (((off_t) -1) == lseek(this->fd, 0, SEEK_SET)) {
+                error_set(error, WARN, "lseek() failed: %s", strerror(errno));
+                return FALSE;
+            }
+            DRNS(inflateReset2)(&this->strm, 15 + 32);
+            this->strm.next_in = this->input;
+            this->strm.avail_in = 0;
+            this->in = this->out = 0;
+            this->raw = FALSE;
+        } else {
+            if (((off_t) -1) == lseek(this->fd, (off_t) (point->in - (0 != point->bits)), SEEK_SET)) {
+                error_set(error, WARN, "lseek() failed: %s", strerror(errno));
+                return FALSE;
+            }
+            this->in = point->in - (0 != point->bits);
+            this->strm.next_in = this->input;
+            this->strm.avail_in = 0;
+            DRNS(inflateReset2)(&this->strm, -15);
+            if (0 != point->bits) {
+                if (-1 == zran_fill(this, error, 1)) {
+                    return FALSE;
+                }
+                if (0 == this->strm.avail_in) {
+                    error_set(error, WARN, "zlib internal error from inflate(): unexpected end of file");
+                    return FALSE;
+                }
+                DRNS(inflatePrime)(&this->strm, point->bits, this->strm.next_in[0] >> (8 - point->bits));
+                this->strm.next_in++;
+                this->strm.avail_in--;
+            }
+            DRNS(inflateSetDictionary)(&this->strm, point->window, point->size);
+            for (i = 0; i < point->size; i++) {
+                pos = (point->out - point->size + i) % ZRAN_WINDOW_SIZE;
+                this->window[pos] = point->window[i];
+            }
+            this->out = point->out;
+            this->raw = TRUE;
+            debug("resumed at %d (from %d)", (int) point->out, (int) offset);
+        }
+        this->eof = FALSE;
+    }
+    while (this->out < offset && !this->eof) {
+        if (-1 == zran_read(this, error, NULL, MIN(offset - this->out, ZRAN_INPUT_SIZE))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+typedef struct {
+    int fd;
+    gzFile gz;  /* NULL while BGZF blocks are inflated by threads, or with --gzip-index */
+    ZRAN *zran; /* NULL unless --gzip-index */
+#ifdef HAVE_PTHREAD
+    BGZF *bgzf;
+#endif /* HAVE_PTHREAD */
+} ZLIB;
+
+#ifdef HAVE_PTHREAD
+/**
+ * Size of the BGZF block which starts at p ([p;p+len[ being available), 0 if this is not one
+ **/
+static size_t bgzf_block_size(const uint8_t *p, size_t len)
+{
+    size_t i, xlen, slen, size;
+
+    if (len < BGZF_HEADER_SIZE || 0x1F != p[0] || 0x8B != p[1] || Z_DEFLATED != p[2] || 0 == (p[3] & 0x04)) {
+        return 0;
+    }
+    xlen = p[10] | (p[11] << 8);
+    if (12 + xlen > len) {
+        return 0;
+    }
+    for (i = 12; i + 4 <= 12 + xlen; i += 4 + slen) {
+        slen = p[i + 2] | (p[i + 3] << 8);
+        if ('B' == p[i] && 'C' == p[i + 1] && 2 == slen && i + 6 <= 12 + xlen) {
+            size = (p[i + 4] | (p[i + 5] << 8)) + 1;
+            /* header and trailer (CRC32 + ISIZE) have to fit */
+            return size >= 12 + xlen + 8 ? size : 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Inflate a whole block and check it against its trailer
+ **/
+static int bgzf_inflate(z_stream *strm, BLOCK *block)
+{
+    int ret;
+    size_t header;
+    const uint8_t *trailer;
+    uint32_t crc, isize;
+
+    header = 12 + (block->in[10] | (block->in[11] << 8));
+    trailer = block->in + block->in_len - 8;
+    DRNS(inflateReset)(strm);
+    strm->next_in = block->in + header;
+    strm->avail_in = block->in_len - header - 8;
+    strm->next_out = (Bytef *) block->out;
+    strm->avail_out = ARRAY_SIZE(block->out);
+    if (Z_STREAM_END != (ret = DRNS(inflate)(strm, Z_FINISH))) {
+        return Z_OK == ret || Z_BUF_ERROR == ret ? Z_DATA_ERROR : ret;
+    }
+    block->out_len = ARRAY_SIZE(block->out) - strm->avail_out;
+    crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t) trailer[3] << 24);
+    isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t) trailer[7] << 24);
+    if (isize != block->out_len || crc != DRNS(crc32)(DRNS(crc32)(0, Z_NULL, 0), (const Bytef *) block->out, block->out_len)) {
+        return Z_DATA_ERROR;
+    }
+
+    return Z_OK;
+}
+
+static void *bgzf_worker(void *data)
+{
+    int status;
+    BGZF *this;
+    BLOCK *block;
+    z_stream strm;
+
+    this = (BGZF *) data;
+    memset(&strm, 0, sizeof(strm));
+    status = DRNS(inflateInit2_)(&strm, -MAX_WBITS, ZLIB_VERSION, (int) sizeof(strm));
+    pthread_mutex_lock(&this->mutex);
+    while (TRUE) {
+        while (!this->stop && this->next == this->filled) {
+            pthread_cond_wait(&this->work, &this->mutex);
+        }
+        if (this->stop) {
+            break;
+        }
+        block = &this->blocks[this->next++ % this->count];
+        pthread_mutex_unlock(&this->mutex);
+        block->status = Z_OK == status ? bgzf_inflate(&strm, block) : status;
+        pthread_mutex_lock(&this->mutex);
+        block->done = TRUE;
+        pthread_cond_broadcast(&this->done);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    if (Z_OK == status) {
+        DRNS(inflateEnd)(&strm);
+    }
+
+    return NULL;
+}
+
+/**
+ * Make at least wanted bytes available in the input buffer (less at end of file)
+ * Return the number of available bytes, -1 on error
+ **/
+static ssize_t bgzf_input_ensure(BGZF *this, error_t **error, size_t wanted)
+{
+    ssize_t ret;
+
+    if (this->input.len - this->input.pos < wanted && !this->input.eof) {
+        memmove(this->input.buffer, this->input.buffer + this->input.pos, this->input.len - this->input.pos);
+        this->input.len -= this->input.pos;
+        this->input.pos = 0;
+        while (this->input.len < BGZF_INPUT_SIZE) {
+            if (-1 == (ret = pread(this->fd, this->input.buffer + this->input.len, BGZF_INPUT_SIZE - this->input.len, this->input.offset))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                error_set(error, WARN, "pread() failed: %s", strerror(errno));
+                return -1;
+            }
+            if (0 == ret) {
+                this->input.eof = TRUE;
+                break;
+            }
+            this->input.len += ret;
+            this->input.offset += ret;
+        }
+    }
+
+    return this->input.len - this->input.pos;
+}
+
+/**
+ * Read blocks in the slots freed by the consumer and hand them to the workers
+ **/
+static UBool bgzf_read_blocks(BGZF *this, error_t **error)
+{
+    BLOCK *block;
+    ssize_t available;
+    size_t filled, size;
+    const uint8_t *p;
+
+    filled = this->filled;
+    while (!this->exhausted && filled < this->current + this->count) {
+        if (-1 == (available = bgzf_input_ensure(this, error, BGZF_MAX_BLOCK_SIZE))) {
+            return FALSE;
+        }
+        p = this->input.buffer + this->input.pos;
+        if (0 == available) {
+            this->exhausted = TRUE;
+        } else if (0 == (size = bgzf_block_size(p, available)) || size > (size_t) available) {
+            this->tail = this->input.offset - available;
+            this->exhausted = TRUE;
+        } else {
+            block = &this->blocks[filled++ % this->count];
+            memcpy(block->in, p, size);
+            block->in_len = size;
+            block->out_len = 0;
+            block->done = FALSE;
+            this->input.pos += size;
+        }
+    }
+    if (filled != this->filled) {
+        pthread_mutex_lock(&this->mutex);
+        this->filled = filled;
+        pthread_cond_broadcast(&this->work);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    return TRUE;
+}
+
+/**
+ * (Re)start from the beginning of the file, once the blocks in progress are inflated
+ **/
+static UBool bgzf_start(BGZF *this, error_t **error)
+{
+    pthread_mutex_lock(&this->mutex);
+    for (; this->current < this->filled; this->current++) {
+        while (!this->blocks[this->current % this->count].done) {
+            pthread_cond_wait(&this->done, &this->mutex);
+        }
+    }
+    this->current = this->next = this->filled = 0;
+    pthread_mutex_unlock(&this->mutex);
+    this->ptr = NULL;
+    this->tail = -1;
+    this->exhausted = FALSE;
+    this->input.pos = this->input.len = 0;
+    this->input.offset = 0;
+    this->input.eof = FALSE;
+
+    return bgzf_read_blocks(this, error);
+}
+
+static void bgzf_close(BGZF *this)
+{
+    int i;
+
+    pthread_mutex_lock(&this->mutex);
+    this->stop = TRUE;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->mutex);
+    for (i = 0; i < this->nthreads; i++) {
+        pthread_join(this->threads[i], NULL);
+    }
+    pthread_cond_destroy(&this->done);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->mutex);
+    free(this->threads);
+    free(this->blocks);
+    free(this->input.buffer);
+    free(this);
+}
+
+/**
+ * Start the workers if fd is a BGZF file worth it
+ * Return NULL if it is not (or they can't be started)
+ **/
+static BGZF *bgzf_open(int fd)
+{
+    BGZF *this;
+    struct stat st;
+    uint8_t header[BGZF_HEADER_SIZE];
+
+    if (env_get_threads() < 2 || -1 == fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < BGZF_MIN_SIZE) {
+        return NULL;
+    }
+    if (BGZF_HEADER_SIZE != pread(fd, header, BGZF_HEADER_SIZE, 0) || 0 == bgzf_block_size(header, BGZF_HEADER_SIZE)) {
+        return NULL;
+    }
+    this = mem_new(*this);
+    this->fd = fd;
+    this->stop = FALSE;
+    this->nthreads = env_get_threads();
+    this->count = this->nthreads * BGZF_BLOCKS_BY_THREAD;
+    this->blocks = mem_new_n(*this->blocks, this->count);
+    this->threads = mem_new_n(*this->threads, this->nthreads);
+    this->input.buffer = mem_new_n(*this->input.buffer, BGZF_INPUT_SIZE);
+    this->current = this->next = this->filled = 0;
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->done, NULL);
+    for (this->nthreads = 0; this->nthreads < env_get_threads(); this->nthreads++) {
+        if (0 != pthread_create(&this->threads[this->nthreads], NULL, bgzf_worker, this)) {
+            break;
+        }
+    }
+    if (0 == this->nthreads) {
+        bgzf_close(this);
+        return NULL;
+    }
+    debug("BGZF file, %d threads", this->nthreads);
+
+    return this;
+}
+
+/**
+ * Give the output of the current block, once inflated
+ * Return the number of bytes, 0 after the last BGZF block, -1 on error
+ **/
+static int32_t bgzf_mapBytes(BGZF *this, error_t **error, const char **bytes, size_t max_len)
+{
+    size_t n;
+    BLOCK *block;
+
+    while (this->current < this->filled) {
+        block = &this->blocks[this->current % this->count];
+        if (NULL == this->ptr) {
+            pthread_mutex_lock(&this->mutex);
+            while (!block->done) {
+                pthread_cond_wait(&this->done, &this->mutex);
+            }
+            pthread_mutex_unlock(&this->mutex);
+            if (Z_OK != block->status) {
+                error_set(error, WARN, "zlib internal error from inflate(): %s", Z_MEM_ERROR == block->status ? "insufficient memory" : "invalid BGZF block");
+                return -1;
+            }
+            this->ptr = block->out;
+        }
+        if (this->ptr < block->out + block->out_len) {
+            n = MIN(max_len, (size_t) (block->out + block->out_len - this->ptr));
+            *bytes = this->ptr;
+            this->ptr += n;
+            return n;
+        }
+        /* block consumed: its slot can take the next block to read */
+        this->ptr = NULL;
+        this->current++;
+        if (!bgzf_read_blocks(this, error)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Continue with gzread from the first member which is not a BGZF block
+ **/
+static UBool zlib_open_tail(ZLIB *this, error_t **error)
+{
+    int fd;
+
+    if (((off_t) -1) == lseek(this->fd, this->bgzf->tail, SEEK_SET)) {
+        error_set(error, WARN, "lseek() failed: %s", strerror(errno));
+        return FALSE;
+    }
+    /* the descriptor is kept for the BGZF part, in case of a rewind */
+    if (-1 == (fd = dup(this->fd))) {
+        error_set(error, WARN, "dup() failed: %s", strerror(errno));
+        return FALSE;
+    }
+    if (NULL == (this->gz = DRNS(gzdopen)(fd, "rb"))) {
+        close(fd);
+        error_set(error, WARN, "gzdopen() failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+#endif /* HAVE_PTHREAD */
+
 static void *zlib_dopen(error_t **error, int fd, const char * const filename)
 {
-    gzFile fp;
+    ZLIB *this;
 
-    if (NULL == (fp = DRNS(gzdopen)(fd, "rb"))) {
+    this = mem_new(*this);
+    this->fd = fd;
+    this->gz = NULL;
+    this->zran = NULL;
+#ifdef HAVE_PTHREAD
+    if (NULL != (this->bgzf = bgzf_open(fd))) {
+        if (!bgzf_start(this->bgzf, error)) {
+            bgzf_close(this->bgzf);
+            free(this);
+            return NULL;
+        }
+        return this;
+    }
+#endif /* HAVE_PTHREAD */
+    if (NULL != (this->zran = zran_open(fd, filename))) {
+        return this;
+    }
+    if (NULL == (this->gz = DRNS(gzdopen)(fd, "rb"))) {
         error_set(error, WARN, "gzdopen() failed on %s", filename);
+        free(this);
+        return NULL;
     }
 #if 0
 #ifdef _MSC_VER
@@ -71,30 +955,77 @@ static void *zlib_dopen(error_t **error, int fd, const char * const filename)
 #endif /* _MSC_VER */
 #endif
 
-    return fp;
+    return this;
 }
 
 static void zlib_close(void *fp)
 {
-    DRNS(gzclose)((gzFile) fp);
+    ZLIB *this;
+
+    this = (ZLIB *) fp;
+    if (NULL != this->gz) {
+        DRNS(gzclose)(this->gz);
+    }
+    if (NULL != this->zran) {
+        zran_close(this->zran);
+    }
+#ifdef HAVE_PTHREAD
+    if (NULL != this->bgzf) {
+        bgzf_close(this->bgzf);
+    }
+#endif /* HAVE_PTHREAD */
+    free(this);
 }
 
 static UBool zlib_eof(void *fp)
 {
+    ZLIB *this;
+
+    this = (ZLIB *) fp;
+    if (NULL != this->zran) {
+        return this->zran->eof;
+    }
+#ifdef HAVE_PTHREAD
+    if (NULL == this->gz) {
+        return this->bgzf->exhausted && this->bgzf->current >= this->bgzf->filled && -1 == this->bgzf->tail;
+    }
+#endif /* HAVE_PTHREAD */
 #ifdef DEBUG_READS
-    debug("eof = %d", DRNS(gzeof)((gzFile) fp));
+    debug("eof = %d", DRNS(gzeof)(this->gz));
 #endif /* DEBUG_READS */
-    return DRNS(gzeof)((gzFile) fp);
+    return DRNS(gzeof)(this->gz);
 }
 
-#ifndef NO_PHYSICAL_REWIND
+static int32_t zlib_readBytes(void *, error_t **, char *, size_t);
+
+# define SIG_MAX_LEN 5
 static UBool zlib_rewindTo(void *fp, error_t **error, int32_t signature_length)
 {
-    if (signature_length != DRNS(gzseek)((gzFile) fp, signature_length, SEEK_SET)) {
+    ZLIB *this;
+
+    this = (ZLIB *) fp;
+#ifdef HAVE_PTHREAD
+    if (NULL != this->bgzf) {
+        char sig[SIG_MAX_LEN];
+
+        if (NULL != this->gz) {
+            DRNS(gzclose)(this->gz);
+            this->gz = NULL;
+        }
+        if (!bgzf_start(this->bgzf, error)) {
+            return FALSE;
+        }
+        return 0 == signature_length || signature_length == zlib_readBytes(fp, error, sig, MIN(signature_length, SIG_MAX_LEN));
+    }
+#endif /* HAVE_PTHREAD */
+    if (NULL != this->zran) {
+        return zran_seek(this->zran, error, signature_length);
+    }
+    if (signature_length != DRNS(gzseek)(this->gz, signature_length, SEEK_SET)) {
         int errnum;
         const char *zerrstr;
 
-        zerrstr = DRNS(gzerror)((gzFile) fp, &errnum);
+        zerrstr = DRNS(gzerror)(this->gz, &errnum);
         if (Z_ERRNO == errnum) {
             error_set(error, WARN, "zlib external error from gzseek(): %s", strerror(errno));
         } else {
@@ -105,37 +1036,64 @@ static UBool zlib_rewindTo(void *fp, error_t **error, int32_t signature_length)
 
     return TRUE;
 }
-#endif /* !NO_PHYSICAL_REWIND */
 
 static int32_t zlib_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
 {
     int ret;
+    ZLIB *this;
+    int32_t total;
+
+    total = 0;
+    this = (ZLIB *) fp;
+    if (NULL != this->zran) {
+        return zran_read(this->zran, error, buffer, max_len);
+    }
+#ifdef HAVE_PTHREAD
+    if (NULL == this->gz) {
+        int32_t n;
+        const char *bytes;
 
-    if (-1 == (ret = DRNS(gzread)((gzFile) fp, buffer, max_len))) {
+        for (; (size_t) total < max_len; total += n) {
+            if (-1 == (n = bgzf_mapBytes(this->bgzf, error, &bytes, max_len - total))) {
+                return -1;
+            }
+            if (0 == n) {
+                break;
+            }
+            memcpy(buffer + total, bytes, n);
+        }
+        if ((size_t) total == max_len || -1 == this->bgzf->tail) {
+            return total;
+        }
+        if (!zlib_open_tail(this, error)) {
+            return -1;
+        }
+    }
+#endif /* HAVE_PTHREAD */
+    if (-1 == (ret = DRNS(gzread)(this->gz, buffer + total, max_len - total))) {
         int errnum;
         const char *zerrstr;
 
-        zerrstr = DRNS(gzerror)((gzFile) fp, &errnum);
+        zerrstr = DRNS(gzerror)(this->gz, &errnum);
         if (Z_ERRNO == errnum) {
             error_set(error, WARN, "zlib external error from gzread(): %s", strerror(errno));
         } else {
             error_set(error, WARN, "zlib internal error from gzread(): %s", zerrstr);
         }
+        return -1;
     }
 #ifdef DEBUG_READS
     debug("asked = %d, get = %d", max_len, ret);
 #endif /* DEBUG_READS */
 
-    return ret;
+    return total + ret;
 }
 
 reader_imp_t zlib_reader_imp =
 {
     FALSE,
     "gzip",
-#if 0
     "\x1F\x8B",
-#endif
 #ifdef DYNAMIC_READERS
     zlib_trydload,
 #endif /* DYNAMIC_READERS */
@@ -143,7 +1101,6 @@ reader_imp_t zlib_reader_imp =
     zlib_close,
     zlib_eof,
     zlib_readBytes
-#ifndef NO_PHYSICAL_REWIND
     , zlib_rewindTo
-#endif /* !NO_PHYSICAL_REWIND */
+    , NULL
 };
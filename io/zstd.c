@@ -0,0 +1,682 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <errno.h>
+
+#include "common.h"
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+/**
+ * zstd files are decoded as a stream (all frames, one after the other)
+ * except when more than one thread is allowed (--threads) and frames are
+ * small enough to be decoded at once: each frame is then decoded by a
+ * worker thread while the output of the previous ones is consumed, in
+ * order. This is the case of files in the seekable format (its seek
+ * table, in a skippable frame at the end of the file, gives the size of
+ * each frame) and of files written by pzstd or zstd -B/--rsyncable with
+ * content sizes. The first frame which can't be decoded at once (too
+ * large, size unknown) ends the parallel decoding: the rest of the file
+ * is streamed.
+ *
+ * The seek table, if any, is also used to rewind: decoding restarts
+ * from the frame which contains the wanted position, not from the
+ * beginning of the file.
+ **/
+
+#define ZSTD_INPUT_SIZE (2 * 1024 * 1024)   /* compressed bytes read at once */
+#define ZSTD_MAX_FRAME_SIZE (8 * 1024 * 1024) /* larger frames are streamed */
+#define ZSTD_FRAMES_BY_THREAD 2
+#ifdef DEBUG
+# define ZSTD_MIN_SIZE 0
+#else
+# define ZSTD_MIN_SIZE (1024 * 1024)        /* smaller files are not worth starting threads */
+#endif /* DEBUG */
+
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A50U   /* to 0x184D2A5F */
+#define ZSTD_SKIPPABLE_MASK 0xFFFFFFF0U
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1U
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+#define ZSTD_SEEKABLE_MAX_FRAMES 0x8000000U
+
+#ifdef DYNAMIC_READERS
+static ZSTD_DCtx *(*DRNS(ZSTD_createDCtx))(void) = NULL;
+static size_t (*DRNS(ZSTD_freeDCtx))(ZSTD_DCtx *) = NULL;
+static size_t (*DRNS(ZSTD_DCtx_reset))(ZSTD_DCtx *, ZSTD_ResetDirective) = NULL;
+static size_t (*DRNS(ZSTD_decompressStream))(ZSTD_DStream *, ZSTD_outBuffer *, ZSTD_inBuffer *) = NULL;
+static size_t (*DRNS(ZSTD_decompressDCtx))(ZSTD_DCtx *, void *, size_t, const void *, size_t) = NULL;
+static size_t (*DRNS(ZSTD_findFrameCompressedSize))(const void *, size_t) = NULL;
+static unsigned long long (*DRNS(ZSTD_getFrameContentSize))(const void *, size_t) = NULL;
+static unsigned (*DRNS(ZSTD_isError))(size_t) = NULL;
+static const char *(*DRNS(ZSTD_getErrorName))(size_t) = NULL;
+
+static UBool zstd_trydload(void)
+{
+    DL_HANDLE handle;
+
+    handle = DL_LOAD("zstd", 1);
+    if (!handle) {
+        if (HAVE_DL_ERROR) {
+            debug("failed loading zstd: %s", DL_ERROR);
+        } else {
+            debug("failed loading zstd");
+        }
+        return FALSE;
+    }
+    DL_GET_SYM(handle, DRNS(ZSTD_createDCtx), "ZSTD_createDCtx");
+    DL_GET_SYM(handle, DRNS(ZSTD_freeDCtx), "ZSTD_freeDCtx");
+    DL_GET_SYM(handle, DRNS(ZSTD_DCtx_reset), "ZSTD_DCtx_reset");
+    DL_GET_SYM(handle, DRNS(ZSTD_decompressStream), "ZSTD_decompressStream");
+    DL_GET_SYM(handle, DRNS(ZSTD_decompressDCtx), "ZSTD_decompressDCtx");
+    DL_GET_SYM(handle, DRNS(ZSTD_findFrameCompressedSize), "ZSTD_findFrameCompressedSize");
+    DL_GET_SYM(handle, DRNS(ZSTD_getFrameContentSize), "ZSTD_getFrameContentSize");
+    DL_GET_SYM(handle, DRNS(ZSTD_isError), "ZSTD_isError");
+    DL_GET_SYM(handle, DRNS(ZSTD_getErrorName), "ZSTD_getErrorName");
+    env_register_resource(handle, (func_dtor_t) DL_UNLOAD);
+
+    return TRUE;
+}
+#endif /* DYNAMIC_READERS */
+
+typedef struct {
+    UBool done;         /* decoded (or failed) */
+    const char *error;  /* NULL if decoded */
+    size_t in_len, in_size;
+    size_t out_len, out_size;
+    uint8_t *in;
+    char *out;
+} FRAME;
+
+typedef struct {
+    off_t compressed;   /* position of the frame in the file */
+    off_t decompressed; /* position of its content in the output */
+} SEEK_ENTRY;
+
+typedef struct {
+    int fd;
+    UBool eof;
+    ZSTD_DCtx *dctx;     /* for streaming */
+    size_t last;         /* last result of ZSTD_decompressStream, 0 at the end of a frame */
+    struct {
+        uint8_t *buffer;
+        size_t pos;
+        size_t len;
+        UBool eof;
+    } input;
+    struct {
+        size_t count;        /* number of frames, 0 if there is no seek table */
+        SEEK_ENTRY *entries; /* count + 1 entries, the last one for the end of the frames */
+    } table;
+#ifdef HAVE_PTHREAD
+    UBool parallel;      /* consumer side: frames are still taken from the workers */
+    UBool sequential;    /* producer side: parallel decoding ended, the rest has to be streamed */
+    UBool exhausted;     /* no more frame to read */
+    size_t frame;        /* index in the seek table of the next frame to read */
+    /* frame of sequence number n is frames[n % count] */
+    size_t count;
+    size_t current;      /* frame being consumed */
+    size_t next;         /* next frame to decode */
+    size_t filled;       /* next frame to read */
+    const char *ptr;     /* into the output of the current frame, NULL if not yet waited for */
+    FRAME *frames;
+    UBool stop;
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work; /* a frame was read or the workers have to stop */
+    pthread_cond_t done; /* a frame was decoded */
+#endif /* HAVE_PTHREAD */
+} ZSTD;
+
+static uint32_t read_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Make at least wanted bytes available in the input buffer (less at end of file)
+ * Return the number of available bytes, -1 on error
+ **/
+static ssize_t zstd_input_ensure(ZSTD *this, error_t **error, size_t wanted)
+{
+    ssize_t ret;
+
+    if (this->input.len - this->input.pos < wanted && !this->input.eof) {
+        memmove(this->input.buffer, this->input.buffer + this->input.pos, this->input.len - this->input.pos);
+        this->input.len -= this->input.pos;
+        this->input.pos = 0;
+        while (this->input.len < wanted) {
+            if (-1 == (ret = read(this->fd, this->input.buffer + this->input.len, ZSTD_INPUT_SIZE - this->input.len))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                error_set(error, WARN, "read() failed: %s", strerror(errno));
+                return -1;
+            }
+            if (0 == ret) {
+                this->input.eof = TRUE;
+                break;
+            }
+            this->input.len += ret;
+        }
+    }
+
+    return this->input.len - this->input.pos;
+}
+
+/**
+ * Load the seek table of a file in the seekable format
+ * (see contrib/seekable_format/zstd_seekable_compression_format.md in zstd sources)
+ **/
+static void zstd_load_seek_table(ZSTD *this, off_t size)
+{
+    size_t i, count, entry_size, table_size;
+    uint8_t footer[ZSTD_SEEKABLE_FOOTER_SIZE], *table;
+
+    if (size < 8 + ZSTD_SEEKABLE_FOOTER_SIZE || ZSTD_SEEKABLE_FOOTER_SIZE != pread(this->fd, footer, ZSTD_SEEKABLE_FOOTER_SIZE, size - ZSTD_SEEKABLE_FOOTER_SIZE)) {
+        return;
+    }
+    /* descriptor: checksum flag (bit 7), reserved bits (2 to 6) have to be zero */
+    if (ZSTD_SEEKABLE_MAGIC != read_le32(footer + 5) || 0 != (footer[4] & 0x7C)) {
+        return;
+    }
+    count = read_le32(footer);
+    entry_size = 0 != (footer[4] & 0x80) ? 12 : 8;
+    if (0 == count || count > ZSTD_SEEKABLE_MAX_FRAMES) {
+        return;
+    }
+    table_size = 8 + count * entry_size + ZSTD_SEEKABLE_FOOTER_SIZE;
+    if ((off_t) table_size > size) {
+        return;
+    }
+    table = mem_new_n(*table, table_size);
+    if ((ssize_t) table_size == pread(this->fd, table, table_size, size - table_size)
+        && ZSTD_SKIPPABLE_MAGIC == (read_le32(table) & ZSTD_SKIPPABLE_MASK)
+        && table_size - 8 == read_le32(table + 4)
+    ) {
+        this->table.entries = mem_new_n(*this->table.entries, count + 1);
+        this->table.entries[0].compressed = this->table.entries[0].decompressed = 0;
+        for (i = 0; i < count; i++) {
+            this->table.entries[i + 1].compressed = this->table.entries[i].compressed + read_le32(table + 8 + i * entry_size);
+            this->table.entries[i + 1].decompressed = this->table.entries[i].decompressed + read_le32(table + 8 + i * entry_size + 4);
+        }
+        if (this->table.entries[count].compressed == size - (off_t) table_size) {
+            this->table.count = count;
+            debug("seekable format, %d frames", (int) count);
+        } else {
+            free(this->table.entries);
+            this->table.entries = NULL;
+        }
+    }
+    free(table);
+}
+
+#ifdef HAVE_PTHREAD
+static void *zstd_worker(void *data)
+{
+    ZSTD *this;
+    FRAME *frame;
+    ZSTD_DCtx *dctx;
+
+    this = (ZSTD *) data;
+    dctx = DRNS(ZSTD_createDCtx)();
+    pthread_mutex_lock(&this->mutex);
+    while (TRUE) {
+        while (!this->stop && this->next == this->filled) {
+            pthread_cond_wait(&this->work, &this->mutex);
+        }
+        if (this->stop) {
+            break;
+        }
+        frame = &this->frames[this->next++ % this->count];
+        pthread_mutex_unlock(&this->mutex);
+        frame->error = NULL;
+        if (NULL == dctx) {
+            frame->error = "insufficient memory";
+        } else {
+            size_t ret;
+
+            ret = DRNS(ZSTD_decompressDCtx)(dctx, frame->out, frame->out_len, frame->in, frame->in_len);
+            if (DRNS(ZSTD_isError)(ret)) {
+                frame->error = DRNS(ZSTD_getErrorName)(ret);
+            } else if (ret != frame->out_len) {
+                frame->error = "size of the frame does not match its content size";
+            }
+        }
+        pthread_mutex_lock(&this->mutex);
+        frame->done = TRUE;
+        pthread_cond_broadcast(&this->done);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    if (NULL != dctx) {
+        DRNS(ZSTD_freeDCtx)(dctx);
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the next frame to decode in parallel, skipping skippable frames
+ * Return FALSE on error, *compressed is set to 0 if there is no such frame
+ **/
+static UBool zstd_next_frame(ZSTD *this, error_t **error, size_t *compressed, size_t *decompressed)
+{
+    ssize_t available;
+    const uint8_t *p;
+    unsigned long long size;
+
+    *compressed = 0;
+    if (this->table.count > 0) {
+        if (this->frame >= this->table.count) {
+            this->exhausted = TRUE;
+            return TRUE;
+        }
+        *compressed = this->table.entries[this->frame + 1].compressed - this->table.entries[this->frame].compressed;
+        *decompressed = this->table.entries[this->frame + 1].decompressed - this->table.entries[this->frame].decompressed;
+        if (*compressed > ZSTD_INPUT_SIZE || *decompressed > ZSTD_MAX_FRAME_SIZE) {
+            *compressed = 0;
+            this->sequential = TRUE;
+        } else if (-1 == (available = zstd_input_ensure(this, error, *compressed))) {
+            return FALSE;
+        } else if ((size_t) available < *compressed) {
+            /* truncated: let the stream report it */
+            *compressed = 0;
+            this->sequential = TRUE;
+        }
+        return TRUE;
+    }
+    while (TRUE) {
+        if (-1 == (available = zstd_input_ensure(this, error, ZSTD_INPUT_SIZE))) {
+            return FALSE;
+        }
+        p = this->input.buffer + this->input.pos;
+        if (0 == available) {
+            this->exhausted = TRUE;
+            return TRUE;
+        }
+        if (available >= 8 && ZSTD_SKIPPABLE_MAGIC == (read_le32(p) & ZSTD_SKIPPABLE_MASK) && 8 + (size_t) read_le32(p + 4) <= (size_t) available) {
+            this->input.pos += 8 + read_le32(p + 4);
+            continue;
+        }
+        size = DRNS(ZSTD_getFrameContentSize)(p, available);
+        *compressed = DRNS(ZSTD_findFrameCompressedSize)(p, available);
+        if (ZSTD_CONTENTSIZE_UNKNOWN == size || ZSTD_CONTENTSIZE_ERROR == size || size > ZSTD_MAX_FRAME_SIZE || DRNS(ZSTD_isError)(*compressed)) {
+            /* frame larger than the input buffer, content size not written, invalid input... */
+            *compressed = 0;
+            this->sequential = TRUE;
+        } else {
+            *decompressed = (size_t) size;
+        }
+        return TRUE;
+    }
+}
+
+/**
+ * Read frames in the slots freed by the consumer and hand them to the workers
+ **/
+static UBool zstd_read_frames(ZSTD *this, error_t **error)
+{
+    FRAME *frame;
+    size_t filled, compressed, decompressed;
+
+    filled = this->filled;
+    while (!this->exhausted && !this->sequential && filled < this->current + this->count) {
+        if (!zstd_next_frame(this, error, &compressed, &decompressed)) {
+            return FALSE;
+        }
+        if (0 == compressed) {
+            break;
+        }
+        frame = &this->frames[filled++ % this->count];
+        if (compressed > frame->in_size) {
+            frame->in = mem_renew(frame->in, *frame->in, compressed);
+            frame->in_size = compressed;
+        }
+        if (decompressed > frame->out_size) {
+            frame->out = mem_renew(frame->out, *frame->out, decompressed);
+            frame->out_size = decompressed;
+        }
+        memcpy(frame->in, this->input.buffer + this->input.pos, compressed);
+        frame->in_len = compressed;
+        frame->out_len = decompressed;
+        frame->done = FALSE;
+        this->input.pos += compressed;
+        this->frame++;
+    }
+    if (filled != this->filled) {
+        pthread_mutex_lock(&this->mutex);
+        this->filled = filled;
+        pthread_cond_broadcast(&this->work);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Wait for the frames in progress, then forget them
+ **/
+static void zstd_drain(ZSTD *this)
+{
+    pthread_mutex_lock(&this->mutex);
+    for (; this->current < this->filled; this->current++) {
+        while (!this->frames[this->current % this->count].done) {
+            pthread_cond_wait(&this->done, &this->mutex);
+        }
+    }
+    this->current = this->next = this->filled = 0;
+    pthread_mutex_unlock(&this->mutex);
+    this->ptr = NULL;
+}
+
+static void zstd_stop_threads(ZSTD *);
+
+/**
+ * Start the workers if the file is worth it
+ **/
+static void zstd_start_threads(ZSTD *this, off_t size)
+{
+    int nthreads;
+
+    if ((nthreads = env_get_threads()) < 2 || size < ZSTD_MIN_SIZE) {
+        return;
+    }
+    this->count = nthreads * ZSTD_FRAMES_BY_THREAD;
+    this->frames = mem_new_n(*this->frames, this->count);
+    memset(this->frames, 0, sizeof(*this->frames) * this->count);
+    this->threads = mem_new_n(*this->threads, nthreads);
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->work, NULL);
+    pthread_cond_init(&this->done, NULL);
+    for (this->nthreads = 0; this->nthreads < nthreads; this->nthreads++) {
+        if (0 != pthread_create(&this->threads[this->nthreads], NULL, zstd_worker, this)) {
+            break;
+        }
+    }
+    if (0 == this->nthreads) {
+        zstd_stop_threads(this);
+        this->frames = NULL;
+        return;
+    }
+    debug("%d threads", this->nthreads);
+}
+
+static void zstd_stop_threads(ZSTD *this)
+{
+    size_t i;
+
+    if (NULL == this->frames) {
+        return;
+    }
+    pthread_mutex_lock(&this->mutex);
+    this->stop = TRUE;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->mutex);
+    for (i = 0; i < (size_t) this->nthreads; i++) {
+        pthread_join(this->threads[i], NULL);
+    }
+    pthread_cond_destroy(&this->done);
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->mutex);
+    for (i = 0; i < this->count; i++) {
+        free(this->frames[i].in);
+        free(this->frames[i].out);
+    }
+    free(this->frames);
+    free(this->threads);
+}
+
+/**
+ * Give the output of the current frame, once decoded
+ * Return the number of bytes, 0 when there is no more frame decoded in parallel, -1 on error
+ **/
+static int32_t zstd_frame_mapBytes(ZSTD *this, error_t **error, const char **bytes, size_t max_len)
+{
+    size_t n;
+    FRAME *frame;
+
+    while (this->current < this->filled) {
+        frame = &this->frames[this->current % this->count];
+        if (NULL == this->ptr) {
+            pthread_mutex_lock(&this->mutex);
+            while (!frame->done) {
+                pthread_cond_wait(&this->done, &this->mutex);
+            }
+            pthread_mutex_unlock(&this->mutex);
+            if (NULL != frame->error) {
+                error_set(error, WARN, "zstd internal error from ZSTD_decompressDCtx(): %s", frame->error);
+                return -1;
+            }
+            this->ptr = frame->out;
+        }
+        if (this->ptr < frame->out + frame->out_len) {
+            n = MIN(max_len, (size_t) (frame->out + frame->out_len - this->ptr));
+            *bytes = this->ptr;
+            this->ptr += n;
+            return n;
+        }
+        /* frame consumed: its slot can take the next frame to read */
+        this->ptr = NULL;
+        this->current++;
+        if (!zstd_read_frames(this, error)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Start decoding from the frame of the seek table at index frame (0 without seek table)
+ **/
+static UBool zstd_start(ZSTD *this, error_t **error, size_t frame)
+{
+    off_t offset;
+
+#ifdef HAVE_PTHREAD
+    if (NULL != this->frames) {
+        zstd_drain(this);
+    }
+#endif /* HAVE_PTHREAD */
+    offset = this->table.count > 0 ? this->table.entries[frame].compressed : 0;
+    if (((off_t) -1) == lseek(this->fd, offset, SEEK_SET)) {
+        error_set(error, WARN, "lseek() failed: %s", strerror(errno));
+        return FALSE;
+    }
+    this->eof = FALSE;
+    this->last = 0;
+    this->input.pos = this->input.len = 0;
+    this->input.eof = FALSE;
+    DRNS(ZSTD_DCtx_reset)(this->dctx, ZSTD_reset_session_only);
+#ifdef HAVE_PTHREAD
+    if (NULL != this->frames) {
+        this->frame = frame;
+        this->parallel = TRUE;
+        this->sequential = this->exhausted = FALSE;
+        return zstd_read_frames(this, error);
+    }
+#endif /* HAVE_PTHREAD */
+
+    return TRUE;
+}
+
+static void zstd_close(void *);
+
+static void *zstd_dopen(error_t **error, int fd, const char * const filename)
+{
+    ZSTD *this;
+    struct stat st;
+
+    this = mem_new(*this);
+    memset(this, 0, sizeof(*this));
+    this->fd = fd;
+    this->input.buffer = mem_new_n(*this->input.buffer, ZSTD_INPUT_SIZE);
+    if (NULL == (this->dctx = DRNS(ZSTD_createDCtx)())) {
+        error_set(error, WARN, "ZSTD_createDCtx() failed on %s", filename);
+        zstd_close(this);
+        return NULL;
+    }
+    if (-1 != fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        zstd_load_seek_table(this, st.st_size);
+#ifdef HAVE_PTHREAD
+        zstd_start_threads(this, st.st_size);
+#endif /* HAVE_PTHREAD */
+    }
+#ifdef HAVE_PTHREAD
+    if (NULL != this->frames && !zstd_start(this, error, 0)) {
+        zstd_close(this);
+        return NULL;
+    }
+#endif /* HAVE_PTHREAD */
+
+    return this;
+}
+
+static void zstd_close(void *fp)
+{
+    ZSTD *this;
+
+    this = (ZSTD *) fp;
+#ifdef HAVE_PTHREAD
+    zstd_stop_threads(this);
+#endif /* HAVE_PTHREAD */
+    if (NULL != this->dctx) {
+        DRNS(ZSTD_freeDCtx)(this->dctx);
+    }
+    free(this->table.entries);
+    free(this->input.buffer);
+    // NOTE: we have not to close this->fd
+    free(this);
+}
+
+static UBool zstd_eof(void *fp)
+{
+    ZSTD *this;
+
+    this = (ZSTD *) fp;
+#ifdef HAVE_PTHREAD
+    if (this->parallel) {
+        return this->exhausted && this->current >= this->filled;
+    }
+#endif /* HAVE_PTHREAD */
+
+    return this->eof;
+}
+
+/**
+ * Decode the input as a stream
+ **/
+static int32_t zstd_stream(ZSTD *this, error_t **error, char *buffer, size_t max_len)
+{
+    size_t ret;
+    ssize_t available;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+
+    out.dst = buffer;
+    out.size = max_len;
+    out.pos = 0;
+    while (out.pos < out.size && !this->eof) {
+        if (-1 == (available = zstd_input_ensure(this, error, 1))) {
+            return -1;
+        }
+        if (0 == available) {
+            if (0 != this->last) {
+                error_set(error, WARN, "zstd: unexpected end of file");
+                return -1;
+            }
+            this->eof = TRUE;
+            break;
+        }
+        in.src = this->input.buffer + this->input.pos;
+        in.size = available;
+        in.pos = 0;
+        ret = DRNS(ZSTD_decompressStream)(this->dctx, &out, &in);
+        this->input.pos += in.pos;
+        if (DRNS(ZSTD_isError)(ret)) {
+            error_set(error, WARN, "zstd internal error from ZSTD_decompressStream(): %s", DRNS(ZSTD_getErrorName)(ret));
+            return -1;
+        }
+        this->last = ret;
+    }
+
+    return out.pos;
+}
+
+static int32_t zstd_readBytes(void *fp, error_t **error, char *buffer, size_t max_len)
+{
+    ZSTD *this;
+    int32_t n, total;
+
+    total = 0;
+    this = (ZSTD *) fp;
+#ifdef HAVE_PTHREAD
+    if (this->parallel) {
+        const char *bytes;
+
+        for (; (size_t) total < max_len; total += n) {
+            if (-1 == (n = zstd_frame_mapBytes(this, error, &bytes, max_len - total))) {
+                return -1;
+            }
+            if (0 == n) {
+                break;
+            }
+            memcpy(buffer + total, bytes, n);
+        }
+        if ((size_t) total == max_len || !this->sequential) {
+            return total;
+        }
+        /* remaining frames can't be decoded in parallel */
+        this->parallel = FALSE;
+    }
+#endif /* HAVE_PTHREAD */
+    if (-1 == (n = zstd_stream(this, error, buffer + total, max_len - total))) {
+        return -1;
+    }
+
+    return total + n;
+}
+
+# define SIG_MAX_LEN 5
+static UBool zstd_rewindTo(void *fp, error_t **error, int32_t signature_length)
+{
+    ZSTD *this;
+    size_t frame;
+    int32_t skip;
+    char sig[SIG_MAX_LEN];
+
+    this = (ZSTD *) fp;
+    frame = 0;
+    /* restart from the frame which holds the wanted position, instead of the first one */
+    while (frame + 1 < this->table.count && this->table.entries[frame + 1].decompressed <= signature_length) {
+        frame++;
+    }
+    if (!zstd_start(this, error, frame)) {
+        return FALSE;
+    }
+    if ((skip = signature_length - (this->table.count > 0 ? this->table.entries[frame].decompressed : 0)) > 0) {
+        return skip == zstd_readBytes(fp, error, sig, MIN(skip, SIG_MAX_LEN));
+    }
+
+    return TRUE;
+}
+
+reader_imp_t zstd_reader_imp =
+{
+    FALSE,
+    "zstd",
+    "\x28\xB5\x2F\xFD",
+#ifdef DYNAMIC_READERS
+    zstd_trydload,
+#endif /* DYNAMIC_READERS */
+    zstd_dopen,
+    zstd_close,
+    zstd_eof,
+    zstd_readBytes
+    , zstd_rewindTo
+    , NULL
+};
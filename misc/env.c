@@ -46,6 +46,14 @@ static const char *stdin_encoding = NULL;
 // unicode stuffs
 static int unit = UNIT_CODEPOINT;
 static UNormalizationMode normalization = UNORM_NONE;//UNORM_NFC;
+// readers
+static int32_t buffer_size = DEFAULT_BUFFER_SIZE;
+static int advice = DEFAULT_ADVICE;
+static int32_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static int threads = DEFAULT_THREADS;
+static uint64_t memlimit = DEFAULT_MEMLIMIT;
+static int gzip_index = DEFAULT_GZIP_INDEX;
+static int archive = DEFAULT_ARCHIVE;
 // error handling
 #ifdef DEBUG
 static int verbosity = INFO;
@@ -178,6 +186,108 @@ void env_set_normalization(UNormalizationMode mode)
     }
 }
 
+int32_t env_get_buffer_size(void)
+{
+    return buffer_size;
+}
+
+void env_set_buffer_size(int32_t size)
+{
+    if (size >= MIN_BUFFER_SIZE) {
+        buffer_size = size;
+    } else {
+        fprintf(stderr, "Buffer size too small (%d < %d), skip\n", size, MIN_BUFFER_SIZE);
+    }
+}
+
+int env_get_advice(void)
+{
+    return advice;
+}
+
+void env_set_advice(int flags)
+{
+    advice = flags;
+}
+
+int32_t env_get_mmap_threshold(void)
+{
+    return mmap_threshold;
+}
+
+void env_set_mmap_threshold(int32_t size)
+{
+    mmap_threshold = size;
+}
+
+/**
+ * Number of threads a reader may use to decompress a single file
+ * (0, the default, means one by online processor)
+ **/
+int env_get_threads(void)
+{
+    if (0 == threads) {
+#ifdef _SC_NPROCESSORS_ONLN
+        long n;
+
+        if ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 1) {
+            threads = MIN(n, MAX_THREADS);
+        } else {
+            threads = 1;
+        }
+#else
+        threads = 1;
+#endif /* _SC_NPROCESSORS_ONLN */
+    }
+
+    return threads;
+}
+
+void env_set_threads(int n)
+{
+    threads = n;
+}
+
+/**
+ * Memory a multithreaded decoder may use (0, the default, means
+ * the decoder chooses)
+ **/
+uint64_t env_get_memlimit(void)
+{
+    return memlimit;
+}
+
+void env_set_memlimit(uint64_t size)
+{
+    memlimit = size;
+}
+
+/**
+ * Are checkpoints kept (and saved) to resume the inflation of gzip files?
+ **/
+int env_get_gzip_index(void)
+{
+    return gzip_index;
+}
+
+void env_set_gzip_index(int mode)
+{
+    gzip_index = mode;
+}
+
+/**
+ * Are members of tar and cpio archives read as inputs of their own?
+ **/
+int env_get_archive(void)
+{
+    return archive;
+}
+
+void env_set_archive(int mode)
+{
+    archive = mode;
+}
+
 static UBool env_check_encoding(const char *encoding)
 {
     UConverter *ucnv;
@@ -12,7 +12,14 @@ enum {
 
 void env_apply(void);
 void env_close(void);
+int env_get_advice(void);
+int env_get_archive(void);
+int32_t env_get_buffer_size(void);
+int env_get_gzip_index(void);
 const char *env_get_inputs_encoding(void);
+uint64_t env_get_memlimit(void);
+int32_t env_get_mmap_threshold(void);
+int env_get_threads(void);
 UNormalizationMode env_get_normalization(void);
 const char *env_get_stdin_encoding(void);
 int env_get_unit(void);
@@ -24,7 +31,14 @@ void _env_register_resource(void *, func_dtor_t, const char *, int) NONNULL();
 # else
 void env_register_resource(void *, func_dtor_t) NONNULL();
 # endif /* DEBUG */
+void env_set_advice(int);
+void env_set_archive(int);
+void env_set_buffer_size(int32_t);
+void env_set_gzip_index(int);
 void env_set_inputs_encoding(const char *);
+void env_set_memlimit(uint64_t);
+void env_set_mmap_threshold(int32_t);
+void env_set_threads(int);
 void env_set_normalization(UNormalizationMode);
 void env_set_outputs_encoding(const char *);
 void env_set_stdin_encoding(const char *);
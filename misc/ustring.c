@@ -888,29 +888,69 @@ static UChar *u_strdup_len(UChar *src, int32_t len)
     return cpy;
 }
 
+/**
+ * Normalizer2 instance for a (legacy) normalization mode, NULL for UNORM_NONE
+ **/
+const UNormalizer2 *ustring_get_normalizer(UNormalizationMode mode)
+{
+    UErrorCode status;
+    const UNormalizer2 *n2;
+
+    status = U_ZERO_ERROR;
+    switch (mode) {
+        case UNORM_NFC:
+            n2 = unorm2_getInstance(NULL, "nfc", UNORM2_COMPOSE, &status);
+            break;
+        case UNORM_NFD:
+            n2 = unorm2_getInstance(NULL, "nfc", UNORM2_DECOMPOSE, &status);
+            break;
+        case UNORM_NFKC:
+            n2 = unorm2_getInstance(NULL, "nfkc", UNORM2_COMPOSE, &status);
+            break;
+        case UNORM_NFKD:
+            n2 = unorm2_getInstance(NULL, "nfkc", UNORM2_DECOMPOSE, &status);
+            break;
+        case UNORM_FCD:
+            n2 = unorm2_getInstance(NULL, "nfc", UNORM2_FCD, &status);
+            break;
+        default:
+            return NULL;
+    }
+
+    return U_SUCCESS(status) ? n2 : NULL;
+}
+
 // TODO: reach back error to caller
 UBool ustring_normalize(UString *ustr, UNormalizationMode mode/*, error_t **error*/) /* NONNULL(1) */
 {
     UErrorCode status;
+    const UNormalizer2 *n2;
 
     require_else_return_false(NULL != ustr);
 
     status = U_ZERO_ERROR;
-    if (UNORM_NONE != mode && ustr->len > 0) {
-        UChar *tmp;
-        int32_t res_len;
-
-        tmp = u_strdup_len(ustr->ptr, ustr->len);
-        res_len = unorm_normalize(tmp, ustr->len, mode, 0, NULL, 0, &status);
-        if (U_BUFFER_OVERFLOW_ERROR == status) {
-            status = U_ZERO_ERROR;
-            _ustring_maybe_expand_to(ustr, res_len);
-            ustr->len = unorm_normalize(tmp, ustr->len, mode, 0, ustr->ptr, ustr->allocated + 1, &status);
+    if (ustr->len > 0 && NULL != (n2 = ustring_get_normalizer(mode))) {
+        int32_t span;
+
+        /* only copy and normalize what follows the part which is already normalized */
+        span = unorm2_spanQuickCheckYes(n2, ustr->ptr, ustr->len, &status);
+        if (U_SUCCESS(status) && (size_t) span < ustr->len) {
+            UChar *tmp;
+            int32_t tmp_len, res_len;
+
+            tmp_len = ustr->len - span;
+            tmp = u_strdup_len(ustr->ptr + span, tmp_len);
+            res_len = unorm2_normalize(n2, tmp, tmp_len, NULL, 0, &status);
+            if (U_BUFFER_OVERFLOW_ERROR == status) {
+                status = U_ZERO_ERROR;
+                _ustring_maybe_expand_to(ustr, span + res_len);
+                ustr->len = span + unorm2_normalize(n2, tmp, tmp_len, ustr->ptr + span, ustr->allocated + 1 - span, &status);
+            }
+            assert(U_ZERO_ERROR == status);
+            free(tmp);
         }
-        assert(U_ZERO_ERROR == status);
-        free(tmp);
         /*if (U_FAILURE(status)) {
-            icu_error_set(error, FATAL, status, "unorm_normalize");
+            icu_error_set(error, FATAL, status, "unorm2_normalize");
         }*/
     }
 
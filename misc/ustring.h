@@ -33,12 +33,13 @@ UString *ustring_convert_argv_from_local(const char *, error_t **, UBool);
 int32_t ustring_delete_len(UString *, size_t, size_t) NONNULL(1);
 void ustring_destroy(UString *) NONNULL();
 void ustring_dump(UString *) NONNULL();
-UString *ustring_dup(const UString *) WARN_UNUSED_RESULT NONNULL();
+UString *ustring_dup(const UString *) WARN_UNUSED_RESULT NONNULL() DUPER;
 UString *ustring_dup_string(const UChar *) NONNULL();
 UString *ustring_dup_string_len(const UChar *, size_t) NONNULL();
 UBool ustring_empty(const UString *) NONNULL();
 UBool ustring_endswith(UString *, UChar *, size_t) NONNULL();
 UBool ustring_fullcase(UString *, UChar *, int32_t, UCaseType, error_t **) NONNULL(1);
+const UNormalizer2 *ustring_get_normalizer(UNormalizationMode);
 void ustring_index(UString *, UBreakIterator *, DArray *) NONNULL();
 int32_t ustring_insert_len(UString *, size_t, const UChar *, size_t) NONNULL(1);
 void ustring_ltrim(UString *) NONNULL();
@@ -1,14 +1,19 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "parsenum.h"
 
 #ifdef WITH_FTS
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <unistd.h>
+# include <fcntl.h>
 # include <errno.h>
 # include <fts.h>
 # include <fnmatch.h>
+# ifdef HAVE_PTHREAD
+#  include <pthread.h>
+# endif /* HAVE_PTHREAD */
 # include "struct/slist.h"
 
 enum {
@@ -35,6 +40,7 @@ enum {
 static int dirbehave = DIR_READ;
 static int linkbehave = LINK_READ;
 static int devbehave = DEV_READ;
+static int prefetch_depth = DEFAULT_PREFETCH;
 
 static slist_t *directory_patterns = NULL;
 static slist_t *file_patterns = NULL;
@@ -182,12 +188,185 @@ UBool skip_file(int fd)
     return FALSE;
 }
 
+/**
+ * Files which come next, in fts order, to the one being searched: each is
+ * opened and the beginning of it (what charset and binary detections read
+ * at least) is read by a thread while the current one is searched, so that
+ * a cold cache (spinning disks, NFS) does not cost a full latency by file.
+ * Without threads, the kernel is only advised that they will be needed.
+ **/
+typedef struct {
+    char **paths;  /* path of the file of sequence number n is paths[n % count] */
+    size_t count;  /* files which can be queued */
+    size_t head;   /* next file to search */
+    size_t tail;   /* next file to queue */
+# ifdef HAVE_PTHREAD
+    size_t next;   /* next file to prefetch */
+    UBool stop;
+    UBool started;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t work; /* a file was queued or the thread has to stop */
+# endif /* HAVE_PTHREAD */
+} prefetch_t;
+
+static void prefetch_file(const char *path, UBool read_prefix)
+{
+    int fd;
+    struct stat st;
+
+    /* O_NONBLOCK: a FIFO would block until a writer shows up */
+    if (-1 == (fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY))) {
+        return;
+    }
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode)) {
+# ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, 0, env_get_buffer_size(), POSIX_FADV_WILLNEED);
+# endif /* POSIX_FADV_WILLNEED */
+        if (read_prefix) {
+            char buffer[MAX_ENC_REL_LEN];
+
+            /* a hint only: failures are for the reader to report */
+            if (-1 == read(fd, buffer, sizeof(buffer))) {
+                debug("prefetch of %s failed: %s", path, strerror(errno));
+            }
+        }
+    }
+    close(fd);
+}
+
+# ifdef HAVE_PTHREAD
+static void *prefetch_worker(void *data)
+{
+    char *path;
+    prefetch_t *this;
+
+    this = (prefetch_t *) data;
+    pthread_mutex_lock(&this->mutex);
+    while (TRUE) {
+        while (!this->stop && this->next == this->tail) {
+            pthread_cond_wait(&this->work, &this->mutex);
+        }
+        if (this->stop) {
+            break;
+        }
+        /* the slot may be reused once the file is searched: work on a copy */
+        path = mem_dup(this->paths[this->next++ % this->count]);
+        pthread_mutex_unlock(&this->mutex);
+        prefetch_file(path, TRUE);
+        free(path);
+        pthread_mutex_lock(&this->mutex);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+# endif /* HAVE_PTHREAD */
+
+static prefetch_t *prefetch_new(int depth)
+{
+    prefetch_t *this;
+
+    this = mem_new(*this);
+    this->count = MAX(depth, 1);
+    this->paths = mem_new_n(*this->paths, this->count);
+    memset(this->paths, 0, sizeof(*this->paths) * this->count);
+    this->head = this->tail = 0;
+# ifdef HAVE_PTHREAD
+    this->next = 0;
+    this->stop = FALSE;
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->work, NULL);
+    this->started = depth > 0 && 0 == pthread_create(&this->thread, NULL, prefetch_worker, this);
+# endif /* HAVE_PTHREAD */
+
+    return this;
+}
+
+static void prefetch_destroy(prefetch_t *this)
+{
+    size_t i;
+
+# ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&this->mutex);
+    this->stop = TRUE;
+    pthread_cond_broadcast(&this->work);
+    pthread_mutex_unlock(&this->mutex);
+    if (this->started) {
+        pthread_join(this->thread, NULL);
+    }
+    pthread_cond_destroy(&this->work);
+    pthread_mutex_destroy(&this->mutex);
+# endif /* HAVE_PTHREAD */
+    for (i = 0; i < this->count; i++) {
+        free(this->paths[i]);
+    }
+    free(this->paths);
+    free(this);
+}
+
+static UBool prefetch_full(prefetch_t *this)
+{
+    return this->tail - this->head >= this->count;
+}
+
+static void prefetch_push(prefetch_t *this, const char *path)
+{
+    char *copy;
+
+    copy = mem_dup(path);
+# ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&this->mutex);
+    this->paths[this->tail++ % this->count] = copy;
+    pthread_cond_signal(&this->work);
+    pthread_mutex_unlock(&this->mutex);
+    if (!this->started && prefetch_depth > 0) {
+        prefetch_file(path, FALSE);
+    }
+# else
+    this->paths[this->tail++ % this->count] = copy;
+    if (prefetch_depth > 0) {
+        prefetch_file(path, FALSE);
+    }
+# endif /* HAVE_PTHREAD */
+}
+
+/**
+ * Return the path of the next file to search (to be freed by the caller),
+ * NULL if none is queued
+ **/
+static char *prefetch_pop(prefetch_t *this)
+{
+    char *path;
+
+    if (this->head == this->tail) {
+        return NULL;
+    }
+# ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&this->mutex);
+# endif /* HAVE_PTHREAD */
+    path = this->paths[this->head % this->count];
+    this->paths[this->head++ % this->count] = NULL;
+# ifdef HAVE_PTHREAD
+    /* too late to prefetch this one */
+    if (this->next < this->head) {
+        this->next = this->head;
+    }
+    pthread_mutex_unlock(&this->mutex);
+# endif /* HAVE_PTHREAD */
+
+    return path;
+}
+
 int procdir(reader_t *reader, char **argv, void *userdata, int (*procfile)(reader_t *reader, const char *filename, void *userdata))
 {
     int ret;
     FTS *fts;
     FTSENT *p;
     int ftsflags;
+    char *path;
+    UBool exhausted;
+    prefetch_t *prefetch;
 
     ret = 0;
     switch (linkbehave) {
@@ -205,43 +384,188 @@ int procdir(reader_t *reader, char **argv, void *userdata, int (*procfile)(reade
         msg(FATAL, "can't fts_open: %s", strerror(errno));
     }
     env_register_resource(fts, (func_dtor_t) fts_close);
-    while (NULL != (p = fts_read(fts))) {
-        switch (p->fts_info) {
-            case FTS_DNR:
-            case FTS_ERR:
-                msg(WARN, "fts_read failed on %s: %s", p->fts_path, strerror(p->fts_errno));
+    prefetch = prefetch_new(prefetch_depth);
+    env_register_resource(prefetch, (func_dtor_t) prefetch_destroy);
+    exhausted = FALSE;
+    while (TRUE) {
+        /* fts runs ahead of the file being searched by up to prefetch_depth files */
+        while (!exhausted && !prefetch_full(prefetch)) {
+            if (NULL == (p = fts_read(fts))) {
+                exhausted = TRUE;
                 break;
-            case FTS_D:
-            case FTS_DP:
-                if (have_directory_excluded || have_directory_included) {
-                    if (!is_directory_matching(p->fts_name) || !is_directory_matching(p->fts_path)) {
-                        fts_set(fts, p, FTS_SKIP);
+            }
+            switch (p->fts_info) {
+                case FTS_DNR:
+                case FTS_ERR:
+                    msg(WARN, "fts_read failed on %s: %s", p->fts_path, strerror(p->fts_errno));
+                    break;
+                case FTS_D:
+                case FTS_DP:
+                    if (have_directory_excluded || have_directory_included) {
+                        if (!is_directory_matching(p->fts_name) || !is_directory_matching(p->fts_path)) {
+                            fts_set(fts, p, FTS_SKIP);
+                        }
+                    }
+                    break;
+                case FTS_DC:
+                    msg(WARN, "recursive directory loop on %s", p->fts_path);
+                    break;
+                default:
+                {
+                    UBool ok;
+
+                    ok = TRUE;
+                    if (have_file_excluded || have_file_included) {
+                        ok &= is_file_matching(p->fts_path);
                     }
+                    if (ok) {
+                        prefetch_push(prefetch, p->fts_path);
+                    }
+                    break;
                 }
-                break;
-            case FTS_DC:
-                msg(WARN, "recursive directory loop on %s", p->fts_path);
+            }
+        }
+        if (NULL == (path = prefetch_pop(prefetch))) {
+            break;
+        }
+        ret |= procarchive(reader, path, userdata, procfile);
+        free(path);
+    }
+    env_unregister_resource(prefetch);
+    env_unregister_resource(fts);
+
+    return ret;
+}
+#endif /* WITH_FTS */
+
+/**
+ * Call procfile on filename or, with --archive=members, on each regular
+ * file of filename if it is a tar or cpio archive, as "filename:path"
+ **/
+int procarchive(reader_t *reader, const char *filename, void *userdata, int (*procfile)(reader_t *reader, const char *filename, void *userdata))
+{
+    int ret;
+    error_t *error;
+    const char *member;
+
+    if (ARCHIVE_MEMBERS != env_get_archive()) {
+        return procfile(reader, filename, userdata);
+    }
+    ret = 0;
+    error = NULL;
+    if (!reader_archive_open(reader, &error, filename)) {
+        print_error(error);
+        return 1;
+    }
+    while (NULL != (member = reader_archive_next(reader, &error))) {
+        ret |= procfile(reader, member, userdata);
+    }
+    if (NULL != error) {
+        print_error(error);
+        ret = 1;
+    }
+    reader_archive_close(reader);
+
+    return ret;
+}
+
+/**
+ * Parse a size in bytes, with an optional K(ilo), M(ega) or G(iga) suffix
+ * (binary multiples), in [min;max], as accepted by --memlimit
+ **/
+static UBool parse_size64(const char *string, uint64_t min, uint64_t max, uint64_t *size)
+{
+    char *endptr;
+    uint64_t multiplier;
+    ParseNumError err;
+
+    multiplier = 1;
+    /* parse_uint64_t negates, as strtoull, what follows a '-' */
+    if ('-' == *string) {
+        return FALSE;
+    }
+    if (PARSE_NUM_NO_ERR != (err = parse_uint64_t(string, &endptr, 10, &min, &max, size))) {
+        if (PARSE_NUM_ERR_NON_DIGIT_FOUND != err || endptr == string || '\0' != endptr[1]) {
+            return FALSE;
+        }
+        switch (*endptr) {
+            case 'G':
+            case 'g':
+                multiplier *= 1024;
+                /* FALLTHROUGH */
+            case 'M':
+            case 'm':
+                multiplier *= 1024;
+                /* FALLTHROUGH */
+            case 'K':
+            case 'k':
+                multiplier *= 1024;
                 break;
             default:
-            {
-                UBool ok;
+                return FALSE;
+        }
+        if (*size < min || *size > max / multiplier) {
+            return FALSE;
+        }
+        *size *= multiplier;
+    }
 
-                ok = TRUE;
-                if (have_file_excluded || have_file_included) {
-                    ok &= is_file_matching(p->fts_path);
-                }
-                if (ok) {
-                    ret |= procfile(reader, p->fts_path, userdata);
-                }
+    return TRUE;
+}
+
+/**
+ * Same as parse_size64, for a positive int32_t, as accepted by --buffer-size
+ * and --mmap-threshold
+ **/
+static UBool parse_size(const char *string, int32_t *size)
+{
+    uint64_t val;
+
+    if (!parse_size64(string, 1, INT32_MAX, &val)) {
+        return FALSE;
+    }
+    *size = (int32_t) val;
+
+    return TRUE;
+}
+
+/**
+ * Parse a comma separated list of access hints, as accepted by --advice
+ **/
+static UBool parse_advice(const char *string, int *flags)
+{
+    size_t i, length;
+    const char *p;
+    static const struct {
+        const char *name;
+        int flag;
+    } hints[] = {
+        { "none",       0 },
+        { "sequential", ADVICE_SEQUENTIAL },
+        { "willneed",   ADVICE_WILLNEED },
+        { "dontneed",   ADVICE_DONTNEED },
+        { "hugepage",   ADVICE_HUGEPAGE }
+    };
+
+    *flags = 0;
+    for (p = string; ; p += length + 1) {
+        length = strcspn(p, ",");
+        for (i = 0; i < ARRAY_SIZE(hints); i++) {
+            if (length == strlen(hints[i].name) && 0 == strncasecmp(p, hints[i].name, length)) {
+                *flags |= hints[i].flag;
                 break;
             }
         }
+        if (ARRAY_SIZE(hints) == i) {
+            return FALSE;
+        }
+        if ('\0' == p[length]) {
+            break;
+        }
     }
-    env_unregister_resource(fts);
 
-    return ret;
+    return TRUE;
 }
-#endif /* WITH_FTS */
 
 UBool util_opt_parse(int c, const char *optarg, reader_t *reader)
 {
@@ -273,6 +597,88 @@ UBool util_opt_parse(int c, const char *optarg, reader_t *reader)
                 return FALSE;
             }
             return TRUE;
+        case BUFFER_SIZE_OPT:
+        {
+            int32_t size;
+
+            if (!parse_size(optarg, &size)) {
+                fprintf(stderr, "Invalid buffer size '%s'\n", optarg);
+                return FALSE;
+            }
+            env_set_buffer_size(size);
+            return TRUE;
+        }
+        case MMAP_THRESHOLD_OPT:
+        {
+            int32_t size;
+
+            if (!parse_size(optarg, &size)) {
+                fprintf(stderr, "Invalid mmap threshold '%s'\n", optarg);
+                return FALSE;
+            }
+            env_set_mmap_threshold(size);
+            return TRUE;
+        }
+        case THREADS_OPT:
+        {
+            char *endptr;
+            int32_t n, min, max;
+
+            min = 1;
+            max = MAX_THREADS;
+            if (PARSE_NUM_NO_ERR != parse_int32_t(optarg, &endptr, 10, &min, &max, &n)) {
+                fprintf(stderr, "Invalid number of threads '%s' (expect 1 to %d)\n", optarg, MAX_THREADS);
+                return FALSE;
+            }
+            env_set_threads(n);
+            return TRUE;
+        }
+        case MEMLIMIT_OPT:
+        {
+            uint64_t size;
+
+            /* 0 restores the default */
+            if (!parse_size64(optarg, 0, UINT64_MAX, &size)) {
+                fprintf(stderr, "Invalid memory limit '%s'\n", optarg);
+                return FALSE;
+            }
+            env_set_memlimit(size);
+            return TRUE;
+        }
+        case GZIP_INDEX_OPT:
+            if (!strcmp("none", optarg)) {
+                env_set_gzip_index(GZIP_INDEX_NONE);
+                return TRUE;
+            } else if (!strcmp("use", optarg)) {
+                env_set_gzip_index(GZIP_INDEX_USE);
+                return TRUE;
+            } else if (!strcmp("save", optarg)) {
+                env_set_gzip_index(GZIP_INDEX_SAVE);
+                return TRUE;
+            }
+            fprintf(stderr, "Invalid gzip index mode '%s' (expect none, use or save)\n", optarg);
+            return FALSE;
+        case ARCHIVE_OPT:
+            if (!strcmp("file", optarg)) {
+                env_set_archive(ARCHIVE_FILE);
+                return TRUE;
+            } else if (!strcmp("members", optarg)) {
+                env_set_archive(ARCHIVE_MEMBERS);
+                return TRUE;
+            }
+            fprintf(stderr, "Invalid archive mode '%s' (expect file or members)\n", optarg);
+            return FALSE;
+        case ADVICE_OPT:
+        {
+            int flags;
+
+            if (!parse_advice(optarg, &flags)) {
+                fprintf(stderr, "Invalid advice '%s'\n", optarg);
+                return FALSE;
+            }
+            env_set_advice(flags);
+            return TRUE;
+        }
         case INPUT_OPT:
             env_set_inputs_encoding(optarg);
             return TRUE;
@@ -321,6 +727,20 @@ UBool util_opt_parse(int c, const char *optarg, reader_t *reader)
         case 'S':
             linkbehave = LINK_READ;
             return TRUE;
+        case FTS_PREFETCH_OPT:
+        {
+            char *endptr;
+            int32_t n, min, max;
+
+            min = 0;
+            max = MAX_PREFETCH;
+            if (PARSE_NUM_NO_ERR != parse_int32_t(optarg, &endptr, 10, &min, &max, &n)) {
+                fprintf(stderr, "Invalid number of files to prefetch '%s' (expect 0 to %d)\n", optarg, MAX_PREFETCH);
+                return FALSE;
+            }
+            prefetch_depth = n;
+            return TRUE;
+        }
         case FTS_INCLUDE_DIR_OPT:
             have_directory_included = TRUE;
             add_fts_pattern(optarg, &directory_patterns, FTS_INCLUDE);
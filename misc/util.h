@@ -9,14 +9,21 @@
 # define GETOPT_SPECIFIC (CHAR_MAX + 1)
 # define GETOPT_COMMON   0xA0
 
-# define GETOPT_COMMON_OPTIONS                       \
-    {"input",  required_argument, NULL, INPUT_OPT},  \
-    {"stdin",  required_argument, NULL, STDIN_OPT},  \
-    {"output", required_argument, NULL, OUTPUT_OPT}, \
-    {"system", required_argument, NULL, SYSTEM_OPT}, \
-    {"form",   required_argument, NULL, FORM_OPT},   \
-    {"unit",   required_argument, NULL, UNIT_OPT},   \
-    {"reader", required_argument, NULL, READER_OPT}
+# define GETOPT_COMMON_OPTIONS                                \
+    {"input",       required_argument, NULL, INPUT_OPT},      \
+    {"stdin",       required_argument, NULL, STDIN_OPT},      \
+    {"output",      required_argument, NULL, OUTPUT_OPT},     \
+    {"system",      required_argument, NULL, SYSTEM_OPT},     \
+    {"form",        required_argument, NULL, FORM_OPT},       \
+    {"unit",        required_argument, NULL, UNIT_OPT},       \
+    {"reader",      required_argument, NULL, READER_OPT},     \
+    {"buffer-size", required_argument, NULL, BUFFER_SIZE_OPT}, \
+    {"advice",      required_argument, NULL, ADVICE_OPT},     \
+    {"mmap-threshold", required_argument, NULL, MMAP_THRESHOLD_OPT}, \
+    {"threads",     required_argument, NULL, THREADS_OPT},    \
+    {"memlimit",    required_argument, NULL, MEMLIMIT_OPT},   \
+    {"gzip-index",  required_argument, NULL, GZIP_INDEX_OPT}, \
+    {"archive",     required_argument, NULL, ARCHIVE_OPT}
 
 # ifdef WITH_FTS
 enum {
@@ -27,6 +34,9 @@ enum {
 
 #  define FTS_COMMON_OPTIONS_STRING "d:D:rRpOS"
 
+#  define DEFAULT_PREFETCH 4 /* files opened and read ahead of the one being searched (0 to disable) */
+#  define MAX_PREFETCH 64
+
 #  define FTS_COMMON_OPTIONS                                        \
     {"exclude",     required_argument, NULL, FTS_EXCLUDE_FILE_OPT}, \
     {"include",     required_argument, NULL, FTS_INCLUDE_FILE_OPT}, \
@@ -34,7 +44,8 @@ enum {
     {"include-dir", required_argument, NULL, FTS_INCLUDE_DIR_OPT},  \
     {"recursive",   no_argument,       NULL, 'r'},                  \
     {"devices",     required_argument, NULL, 'D'},                  \
-    {"directories", required_argument, NULL, 'd'}
+    {"directories", required_argument, NULL, 'd'},                  \
+    {"prefetch",    required_argument, NULL, FTS_PREFETCH_OPT}
 # else
 #  define FTS_COMMON_OPTIONS_STRING ""
 # endif /* WITH_FTS */
@@ -49,10 +60,18 @@ enum {
     FTS_EXCLUDE_DIR_OPT,
     FTS_INCLUDE_FILE_OPT,
     FTS_EXCLUDE_FILE_OPT,
+    FTS_PREFETCH_OPT,
 # endif /* WITH_FTS */
     FORM_OPT,
     UNIT_OPT,
-    READER_OPT
+    READER_OPT,
+    BUFFER_SIZE_OPT,
+    ADVICE_OPT,
+    MMAP_THRESHOLD_OPT,
+    THREADS_OPT,
+    MEMLIMIT_OPT,
+    GZIP_INDEX_OPT,
+    ARCHIVE_OPT
 };
 
 # ifdef WITH_FTS
@@ -61,6 +80,7 @@ UBool skip_file(int);
 UBool is_file_matching(char *);
 int procdir(reader_t *, char **, void *, int (*procfile)(reader_t *, const char *, void *));
 # endif /* WITH_FTS */
+int procarchive(reader_t *, const char *, void *, int (*procfile)(reader_t *, const char *, void *));
 UBool stdin_is_tty(void);
 UBool stdout_is_tty(void);
 void ubrk_unbindText(UBreakIterator *);
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# charset: UTF-8
+
+# Run the cases of ugrep.sh and ucat.sh again with the readers which are
+# not chosen by default for regular files (see READER in assert.sh.inc)
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+RET=0
+for READER in uring pipe; do
+    ./ugrep --reader=${READER} -q x /dev/null 2>/dev/null
+    if [ $? -gt 1 ]; then
+        echo "`basename $0`: reader ${READER} is not available"
+        continue
+    fi
+    for TEST in ugrep.sh ucat.sh; do
+        READER=${READER} bash ${TESTDIR}/${TEST} | sed "s/^${TEST}, /${TEST} (--reader=${READER}), /"
+        [ ${PIPESTATUS[0]} -eq 0 ] || RET=1
+    done
+done
+
+exit ${RET}
@@ -47,13 +47,13 @@ static int procfile(reader_t *reader, const char *filename)
 int main(int argc, char **argv)
 {
     int c, ret;
-    reader_t reader;
+    reader_t *reader;
 
     env_init(EXIT_FAILURE);
-    reader_init(&reader, DEFAULT_READER_NAME);
+    reader = reader_new(DEFAULT_READER_NAME);
 
     while (-1 != (c = getopt_long(argc, argv, optstr, long_options, NULL))) {
-        if (!util_opt_parse(c, optarg, &reader)) {
+        if (!util_opt_parse(c, optarg, reader)) {
             usage();
         }
     }
@@ -64,10 +64,10 @@ int main(int argc, char **argv)
 
     ret = 0;
     if (0 == argc) {
-        ret |= procfile(&reader, "-");
+        ret |= procfile(reader, "-");
     } else {
         for ( ; argc--; ++argv) {
-            ret |= procfile(&reader, *argv);
+            ret |= procfile(reader, *argv);
         }
     }
 
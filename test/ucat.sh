@@ -27,4 +27,12 @@ for ARGS in "-b" "-s" "-n" "-bs" "-ns"; do
     assertOutputValueExIgnoreBlanks "${ARGS}" "./ucat ${UGREP_OPTS} ${ARGS} ${UFILE} 2> /dev/null" "cat ${ARGS} ${FILE}"
 done
 
+for SIZE in "8" "4K"; do
+    assertOutputValueExIgnoreBlanks "--buffer-size=${SIZE}" "./ucat ${UGREP_OPTS} --buffer-size=${SIZE} ${UFILE} 2> /dev/null" "cat ${FILE}"
+done
+
+INPUT="echo -en \"a\r\nb\rc\""
+assertOutputCommand "line endings" "${INPUT} | ./ucat ${UGREP_OPTS} --buffer-size=8 2> /dev/null" "echo -en \"a\nb\nc\n\""
+assertOutputValue "empty input" "echo -n | ./ucat ${UGREP_OPTS} 2> /dev/null | wc -c" 0 "-eq"
+
 exit $?
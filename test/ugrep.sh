@@ -52,6 +52,15 @@ ARGS='--color=never -vm 2 z'
 assertOutputCommand "revert-match + max-count" "${INPUT} | ./ugrep ${UGREP_OPTS} ${ARGS} 2>/dev/null" "echo -en \"a\na\""
 assertOutputValue "revert-match + count + max-count" "${INPUT} | ./ugrep -c ${UGREP_OPTS} ${ARGS} 2>/dev/null" 2 "-eq"
 
+INPUT="echo -en \"a\xE2\x80\xA8a\xC2\x85b\r\na\x0Ba\""
+assertOutputValue "Unicode line separators (-c)" "${INPUT} | ./ugrep ${UGREP_OPTS} -c a 2>/dev/null" 4 "-eq"
+INPUT="echo -en \"a\tb\nab\n\""
+assertOutputValue "tabulation (-c)" "${INPUT} | ./ugrep ${UGREP_OPTS} -c '\t' 2>/dev/null" 1 "-eq"
+
+ARGS='-c mis'
+assertOutputValue "binary file skipped (--binary-files=without-match)" "./ugrep ${UGREP_OPTS} --binary-files=without-match ${ARGS} ${TESTDIR}/binary_eleve.txt 2>/dev/null" ''
+assertOutputValue "binary file as text (--binary-files=text)" "./ugrep ${UGREP_OPTS} --binary-files=text ${ARGS} ${TESTDIR}/binary_eleve.txt 2>/dev/null" 2 "-eq"
+
 declare -r SDBDA_NFC=$'\xE1\xB9\xA9'
 declare -r SDBDA_NFD=$'\x73\xCC\xA3\xCC\x87'
 declare -r SDBDA_NONE=$'\x73\xCC\x87\xCC\xA3'
@@ -81,10 +90,70 @@ ARGS='--color=never zzz'
 assertOutputCommand "file with match (-l)" "./ugrep ${UGREP_OPTS} -l ${ARGS} ${FILE} 2>/dev/null" "grep -l ${ARGS} ${FILE}"
 assertOutputCommand "file without match (-L)" "./ugrep ${UGREP_OPTS} -L ${ARGS} ${FILE} 2>/dev/null" "grep -L ${ARGS} ${FILE}"
 
+INPUT="/tmp/${PPID}.bzh"
+printf 'BZh is a nice word\n' > ${INPUT}
+assertOutputValue "text file starting with a compression magic string" "./ugrep ${UGREP_OPTS} -c nice ${INPUT} 2>/dev/null" 1 "-eq"
+
+# members: first.txt (2 lines with alpha), a 133 characters long name (1) and last.txt (0)
+LONG_NAME="$(printf 'long_%.0s' {1..25})name.txt"
+for ARCHIVE in archive_gnu.tar archive_pax.tar archive_newc.cpio archive_odc.cpio; do
+    FILE="${DATADIR}/${ARCHIVE}"
+    assertOutputValue "archive members (${ARCHIVE})" "./ugrep ${UGREP_OPTS} --archive=members -Hc alpha ${FILE} 2>/dev/null | tr '\n' ' '" "${FILE}:first.txt:2 ${FILE}:${LONG_NAME}:1 ${FILE}:last.txt:0 "
+done
+FILE="${DATADIR}/archive_gnu.tar"
+assertOutputValue "archive members with match (-l)" "./ugrep ${UGREP_OPTS} --archive=members -l alpha ${FILE} 2>/dev/null | tr '\n' ' '" "${FILE}:first.txt ${FILE}:${LONG_NAME} "
+assertOutputValue "archive members read from stdin" "cat ${FILE} | ./ugrep ${UGREP_OPTS} --archive=members -Hc alpha - 2>/dev/null | tr '\n' ' '" "(standard input):first.txt:2 (standard input):${LONG_NAME}:1 (standard input):last.txt:0 "
+INPUT="/tmp/${PPID}.tar"
+head -c 1600 ${FILE} > ${INPUT}
+assertOutputValue "truncated archive" "./ugrep ${UGREP_OPTS} --archive=members -Hc alpha ${INPUT} 2>/dev/null" "${INPUT}:first.txt:2"
+assertOutputValue "truncated archive (warning)" "./ugrep ${UGREP_OPTS} --archive=members -c alpha ${INPUT} 2>&1 >/dev/null | grep -c 'unexpected end of archive'" 1 "-eq"
+# members: u16.txt (UTF-16 with BOM), bin.txt (NUL) and plain.txt, all with alpha
+FILE="${DATADIR}/archive_charsets.tar"
+assertOutputValue "archive members charset and binary detection" "./ugrep ${UGREP_OPTS} --archive=members -H alpha ${FILE} 2>/dev/null | tr '\n' ' '" "${FILE}:u16.txt:alpha ${FILE}:plain.txt:alpha "
+assertOutputValue "archive members charset and binary detection (stdin)" "cat ${FILE} | ./ugrep ${UGREP_OPTS} --archive=members -H alpha - 2>/dev/null | tr '\n' ' '" "(standard input):u16.txt:alpha (standard input):plain.txt:alpha "
+
+# all of them are seq 1 8000, split in 4 members, streams or frames
+COMPRESSED_OPTS="${UGREP_OPTS%% --reader=*}"
+EXPECTED=$(seq 1 8000 | grep -c 7)
+COMPRESSED="multi_member.gz bgzf.gz multi_stream.bz2"
+if ./ugrep --reader=zstd -q 7 /dev/null 2>/dev/null; [ $? -lt 2 ]; then
+    COMPRESSED="${COMPRESSED} seekable.zst"
+fi
+for ARCHIVE in ${COMPRESSED}; do
+    FILE="${DATADIR}/${ARCHIVE}"
+    assertOutputValue "compressed file (${ARCHIVE}, --threads=1)" "./ugrep ${COMPRESSED_OPTS} --threads=1 -c 7 ${FILE} 2>/dev/null" ${EXPECTED} "-eq"
+    assertOutputValue "compressed file (${ARCHIVE}, --threads=2)" "./ugrep ${COMPRESSED_OPTS} --threads=2 -c 7 ${FILE} 2>/dev/null" ${EXPECTED} "-eq"
+    # buffers too small to rewind in memory after charset detection
+    assertOutputValue "compressed file (${ARCHIVE}, --threads=2, rewound)" "./ugrep ${COMPRESSED_OPTS} --threads=2 --buffer-size=1K -c 7 ${FILE} 2>/dev/null" ${EXPECTED} "-eq"
+done
+INPUT="/tmp/${PPID}.gz"
+seq 1 100000 | gzip > ${INPUT}
+EXPECTED=$(seq 1 100000 | grep -c 7)
+assertOutputValue "gzip index (--gzip-index=save)" "./ugrep ${COMPRESSED_OPTS} --gzip-index=save -c 7 ${INPUT} 2>/dev/null" ${EXPECTED} "-eq"
+assertExitValue "gzip index (--gzip-index=save) written" "test -s ${INPUT}.zran" 0
+assertOutputValue "gzip index (--gzip-index=use)" "./ugrep ${COMPRESSED_OPTS} --gzip-index=use --buffer-size=1K -c 7 ${INPUT} 2>/dev/null" ${EXPECTED} "-eq"
+
+ARGS='--color=never -Hc élève'
+INPUT="find ${TESTDIR} -type f -exec ./ugrep ${UGREP_OPTS} ${ARGS} {} + 2>/dev/null | sort"
+assertOutputValueEx "recursive search (-r)" "./ugrep ${UGREP_OPTS} -r ${ARGS} ${TESTDIR} 2>/dev/null | sort" "${INPUT}"
+for PREFETCH in 0 1; do
+    assertOutputValueEx "recursive search (-r, --prefetch=${PREFETCH})" "./ugrep ${UGREP_OPTS} --prefetch=${PREFETCH} -r ${ARGS} ${TESTDIR} 2>/dev/null | sort" "${INPUT}"
+done
+
 FILE='engine.h' # Others are too "particular"
 ARGS="--color=never -nw ''"
 assertOutputValueEx "empty pattern" "./ugrep ${UGREP_OPTS} -E ${ARGS} ${FILE} 2>/dev/null" "grep ${ARGS} ${FILE}"
 assertOutputValueEx "empty pattern + word (-w)" "./ugrep ${UGREP_OPTS} -Ew ${ARGS} ${FILE} 2>/dev/null" "grep -w ${ARGS} ${FILE}"
 assertOutputValueEx "empty pattern + whole line (-x)" "./ugrep ${UGREP_OPTS} -Ex ${ARGS} ${FILE} 2>/dev/null" "grep -x ${ARGS} ${FILE}"
 
+FILE='bin/ugrep.c'
+ARGS="--color=never -n 'int32_t [a-z]+'"
+assertOutputValueEx "line window (--line-window) without over-long lines" "./ugrep ${UGREP_OPTS} -E --line-window=4096 ${ARGS} ${FILE} 2>/dev/null" "grep -E ${ARGS} ${FILE}"
+INPUT="cat ${FILE} | tr -d '\\n'"
+ARGS="--color=never -Eo 'int32_t [a-z]+'"
+assertOutputValueEx "line window (--line-window) on an over-long line (-o)" "${INPUT} | ./ugrep ${UGREP_OPTS} --line-window=64 ${ARGS} 2>/dev/null" "${INPUT} | grep ${ARGS}"
+assertOutputValue "line window (--line-window) on an over-long line (-c)" "${INPUT} | ./ugrep ${UGREP_OPTS} --line-window=64 -c window 2>/dev/null" 1 "-eq"
+assertOutputValue "line window (--line-window) on an over-long line (-vc)" "${INPUT} | ./ugrep ${UGREP_OPTS} --line-window=64 -vc window 2>/dev/null" 0 "-eq"
+assertExitValue "line window (--line-window) rejected with printing -v" "${INPUT} | ./ugrep ${UGREP_OPTS} --line-window=64 -v window >/dev/null 2>&1" 1 "-gt"
+
 exit $?